@@ -0,0 +1,214 @@
+/*
+ ============================================================================
+ Name        : bench.c
+
+ Copyright   : Apache License
+
+ Description :
+
+ Synthetic control program for gopard benchmarks. gopard runs it as
+ control process:
+
+   gopard <status dir> bench <scenario> <jobs> <concurrency> <bytes> <result file>
+
+ It keeps <concurrency> jobs in flight until <jobs> were executed, each
+ job being this program again in job mode writing <bytes> to stdout:
+
+   bench job <bytes>
+
+ Job writes its start and end time (CLOCK_REALTIME ns) to stderr right
+ before exit, so control can measure against events it reads from
+ standard input:
+
+   exec to invoked    exec line written -> started event received
+   exit to finished   job end time      -> finished event received
+
+ Result is one JSON object appended to <result file>.
+
+ ============================================================================
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+static uint64_t _now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int _job(long bytes){
+	static char block[0x10000];
+	uint64_t start = _now();
+	memset(block, 'x', sizeof(block));
+	for (size_t i = 63; i < sizeof(block); i += 64) {
+		block[i] = '\n';
+	}
+	while( bytes > 0 ){
+		size_t chunk = (size_t)bytes < sizeof(block) ? (size_t)bytes : sizeof(block);
+		ssize_t n = write(STDOUT_FILENO, block, chunk);
+		if( n < 0 ){
+			if( errno == EINTR ) continue;
+			return 1;
+		}
+		bytes -= n;
+	}
+	char line[64];
+	int n = snprintf(line, sizeof(line), "%" PRIu64 " %" PRIu64 "\n", start, _now());
+	write(STDERR_FILENO, line, n);
+	return 0;
+}
+
+typedef struct {
+	uint64_t execTime;
+	uint64_t startedTime;
+	uint64_t finishedTime;
+	uint64_t jobStart;
+	uint64_t jobEnd;
+} Sample;
+
+static int _compare(const void * a, const void * b){
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void _percentiles(FILE * out, const char * name, uint64_t * values, long count){
+	qsort(values, count, sizeof(uint64_t), &_compare);
+	fprintf(out, "\"%s\":{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}", name,
+			values[count * 50 / 100] / 1e3,
+			values[count * 90 / 100] / 1e3,
+			values[count * 99 / 100] / 1e3,
+			values[count - 1] / 1e3);
+}
+
+/*
+ Reads job start/end written by job into stderr.log of its directory.
+*/
+static void _readJobTimes(Sample * s, const char * dir){
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/stderr.log", dir);
+	FILE * f = fopen(path, "r");
+	if( !f ) return;
+	if( 2 != fscanf(f, "%" SCNu64 " %" SCNu64, &s->jobStart, &s->jobEnd) ){
+		s->jobStart = s->jobEnd = 0;
+	}
+	fclose(f);
+}
+
+static void _exec(char * self, long bytes, Sample * s){
+	s->execTime = _now();
+	printf("exec:%s job %ld\n", self, bytes);
+}
+
+int main(int argc, char **argv) {
+	if( argc == 3 && 0 == strcmp(argv[1], "job") ){
+		return _job(atol(argv[2]));
+	}
+	if( argc != 6 ){
+		fprintf(stderr, "USAGE: bench <scenario> <jobs> <concurrency> <bytes> <result file>\n"
+				"       bench job <bytes>\n");
+		return EXIT_FAILURE;
+	}
+	const char * scenario = argv[1];
+	long jobs = atol(argv[2]);
+	long concurrency = atol(argv[3]);
+	long bytes = atol(argv[4]);
+	char self[4096];
+	ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if( len < 0 ) return EXIT_FAILURE;
+	self[len] = 0;
+
+	Sample * samples = jobs > 0 ? calloc(jobs, sizeof(Sample)) : NULL;
+	if( !samples ){
+		fprintf(stderr, "bench: cannot allocate %ld samples\n", jobs);
+		return EXIT_FAILURE;
+	}
+	long sent = 0, done = 0, failed = 0;
+	uint64_t begin = _now();
+	for (; sent < jobs && sent < concurrency; ++sent) {
+		_exec(self, bytes, samples + sent);
+	}
+	fflush(stdout);
+	char * line = NULL;
+	size_t size = 0;
+	while( done < jobs && getline(&line, &size, stdin) > 0 ){
+		uint64_t now = _now();
+		char * fields = strchr(line, ':');
+		if( !fields || *(fields + 1) != 'j' ) continue;
+		*fields++ = 0;
+		long seq = atol(fields + 1) - 1;
+		if( seq < 0 || seq >= jobs ) continue;
+		if( 0 == strcmp(line, "started") ){
+			samples[seq].startedTime = now;
+		}else if( 0 == strcmp(line, "finished") ){
+			//finished:job,id,pid,returnCode,startTime,endTime,statusDirectory
+			samples[seq].finishedTime = now;
+			char * dir = fields;
+			for (int i = 0; i < 6 && dir; ++i) {
+				dir = strchr(dir, ',');
+				if( dir ) ++dir;
+			}
+			if( dir ){
+				dir[strcspn(dir, "\n")] = 0;
+				_readJobTimes(samples + seq, dir);
+			}
+			char * rc = strchr(strchr(strchr(fields, ',') + 1, ',') + 1, ',') + 1;
+			if( atoi(rc) != 0 ) failed += 1;
+			done += 1;
+			if( sent < jobs ){
+				_exec(self, bytes, samples + sent);
+				sent += 1;
+				fflush(stdout);
+			}
+		}
+	}
+	uint64_t wall = _now() - begin;
+
+	uint64_t * invoked = calloc(jobs, sizeof(uint64_t));
+	uint64_t * finished = calloc(jobs, sizeof(uint64_t));
+	uint64_t * rate = calloc(jobs, sizeof(uint64_t));
+	if( !invoked || !finished || !rate ){
+		fprintf(stderr, "bench: cannot allocate results\n");
+		return EXIT_FAILURE;
+	}
+	long nInvoked = 0, nFinished = 0;
+	for (long i = 0; i < jobs; ++i) {
+		Sample * s = samples + i;
+		if( s->startedTime ) invoked[nInvoked++] = s->startedTime - s->execTime;
+		if( s->jobEnd && s->finishedTime >= s->jobEnd ){
+			finished[nFinished] = s->finishedTime - s->jobEnd;
+			/* bytes per ms of job life, kept as integer for sorting */
+			rate[nFinished] = bytes * 1000000 / (s->jobEnd - s->jobStart + 1);
+			nFinished += 1;
+		}
+	}
+	FILE * out = fopen(argv[5], "a");
+	if( !out ) return EXIT_FAILURE;
+	double seconds = wall / 1e9;
+	fprintf(out, "{\"scenario\":\"%s\",\"jobs\":%ld,\"concurrency\":%ld,\"bytes_per_job\":%ld,"
+			"\"completed\":%ld,\"failed\":%ld,\"wall_s\":%.3f,\"jobs_per_s\":%.1f,\"aggregate_mb_per_s\":%.1f",
+			scenario, jobs, concurrency, bytes, done, failed, seconds,
+			done / seconds, (double)bytes * done / 1e6 / seconds);
+	if( nFinished > 0 ){
+		qsort(rate, nFinished, sizeof(uint64_t), &_compare);
+		fprintf(out, ",\"job_mb_per_s\":{\"p50\":%.1f,\"min\":%.1f}",
+				rate[nFinished / 2] * 1e3 / 1e6, rate[0] * 1e3 / 1e6);
+		fputc(',', out);
+		_percentiles(out, "exit_to_finished_us", finished, nFinished);
+	}
+	if( nInvoked > 0 ){
+		fputc(',', out);
+		_percentiles(out, "exec_to_invoked_us", invoked, nInvoked);
+	}
+	fprintf(out, "}\n");
+	fclose(out);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#!/bin/bash
+# Runs gopard benchmark scenarios and prints JSON array of results.
+#
+#   bench/run.sh [gopard binary] [gopard options ...]
+#
+# e.g. bench/run.sh build/gopard --capture=splice > splice.json
+# JOBS, CONCURRENCY and MB override default scenario sizes.
+set -e
+HERE=`dirname $0`
+BUILD=${BUILD:-$HERE/../build}
+GOPARD=${1:-$BUILD/gopard}
+shift || true
+BENCH=$BUILD/bench
+JOBS=${JOBS:-2000}
+CONCURRENCY=${CONCURRENCY:-"1 16 128"}
+MB=${MB:-256}
+
+OUT=`mktemp -d`
+trap "rm -rf $OUT" EXIT
+
+scenario(){
+	"$GOPARD" "$@" $OUT/status $BENCH $SCENARIO $N $C $BYTES $OUT/results.json > /dev/null
+	rm -rf $OUT/status
+}
+
+for C in $CONCURRENCY; do
+	SCENARIO=spawn N=$JOBS BYTES=0 scenario "$@"
+done
+SCENARIO=capture N=1 C=1 BYTES=$((MB * 1048576)) scenario "$@"
+SCENARIO=capture N=8 C=8 BYTES=$((MB * 1048576 / 8)) scenario "$@"
+SCENARIO=capture N=$JOBS C=64 BYTES=65536 scenario "$@"
+
+echo "["
+sed '$!s/$/,/' $OUT/results.json
+echo "]"
@@ -23,21 +23,149 @@
  Control program invokes processes by printing commands into standard output
 
  Execute process - exec:<command line>
+                   exec[<option>=<value> ...]:<command line>
+   priority=<n>       higher runs first when jobs are queued
+   compress=<bytes>   gzip logs in frames of <bytes>, 0 disables
+   maxout=<bytes>     keep at most <bytes> of each stream
+   rotate=<bytes>     continue log in stdout.log.1, .2 ... every <bytes>
+   ring=<bytes>       keep first segment and last <bytes> in segments
+   index=<ms>         write stdout.idx/stderr.idx every <ms> of output
+   as=, cpu=, nofile=, nproc=  RLIMIT_AS (bytes), RLIMIT_CPU (seconds) ...
+   nice=<n>           scheduling priority of job
+   ionice=<class>[:<level>]    io class rt, be or idle
+   memory=<bytes>     memory.max of job cgroup (with --cgroup)
+   cpus=<n>           cpu.max of job cgroup, in CPUs (with --cgroup)
+   sync=1             fdatasync logs when job finished
+   id=<name>          job name in events and commands (default j<n>)
+   stdin=pipe         job reads standard input fed by control
+   stdin=<file>       job reads standard input from <file>
+   timeout=<ms>       terminate job running longer than <ms>
+   grace=<ms>         wait before SIGKILL follows SIGTERM (default 5000)
+   retry=<n>          run failed job again, up to <n> times
+   retryon=<code>,... exit codes worth retry (default any failure but cancel)
+   backoff=<ms>       delay before first retry, doubled for every next one
+                      and jittered (default 1000); stdin=pipe jobs are
+                      not retried
+   after=<job>,...    hold job until listed jobs succeeded; if any of them
+                      fails, is cancelled or skipped, job is skipped
+   afterany=<job>,... hold job until listed jobs finished, however they did
+   env=<name>=<value> set variable in job environment, env=<name> unsets;
+                      jobs start with environment gopard was started with
+   cwd=<dir>          working directory of job (default its status directory)
+ Command without '/' is looked up in PATH of job environment; relative
+ entries of PATH are taken in cwd=, and skipped for jobs without it. PWD
+ of gopard is not passed to jobs.
+ Jobs listed in after=/afterany= must be submitted before. Outcome of
+ last MAX_OUTCOMES jobs named with id= is remembered after they finished,
+ so later jobs can depend on them too; older are unknown. Held jobs are
+ reported as invoked:job,HELD,...
+ Feed job stdin - stdin:<job> <text>       writes <text> and newline
+                  stdin[file=<path>]:<job> writes content of <path>
+                  eof:<job>                closes stdin once input is written
+ Stop job - cancel:<job>
+   running job gets SIGTERM, then SIGKILL after grace period, sent to
+   its process group; queued job is dropped
  Print something - print:<text>
+ Switch to binary - protocol:binary
+   acknowledged by protocol:binary event, first one sent as frame; events
+   before it are lines
+
+ In binary protocol control writes frames:
+   u32 length of type and payload (big endian), u8 type, payload
+ where strings are u32 length (including terminating zero) followed by
+ zero terminated bytes, and frames are
+   'x' exec:  u32 count, <options> string, <count-1> argv strings
+   'b' batch: sequence of complete exec frames
+   'p' print: one string
+   's' stdin: <job> string followed by raw bytes, no bytes is eof
+   'f' stdin file: <job> and <path> strings
+   'c' cancel: <job> string
+
+ Jobs beyond --max-running wait in queue, highest priority first, and
+ are recorded in queued.csv. When queue reaches --max-queue gopard stops
+ reading control output until jobs finish.
 
  Control program can also listen on standard input about program invocations
- events:
+ events, as lines <event>:<field>,... (times are seconds since epoch)
+
+ invoked:job,state,priority,cmd
+ started:job,id,pid,startTime,statusDirectory
+ output:job,id,stream,size (once stream has bytes)
+ finished:job,id,pid,returnCode,startTime,endTime,statusDirectory
+ cancelled:job
+ retry:job,attempt,delayMillis
+ skipped:job
+ dropped:count
+ protocol:binary
+
+ or, in binary protocol, as 'e' frames: u32 count, event name and field
+ strings. Events are never waited for: if control does not read them,
+ they are dropped and counted.
+
+ Same information is kept in files of control status directory:
+
+ queued.csv
+ job,priority,queuedTime,cmd
 
  invoked.csv
- id,pid,runType,startTime,statusDirectory,cmd
+ id,pid,runType,startTime,statusDirectory,job,cmd
+
+ stdindex.csv (in status directory of each run)
+ stream,time,size
+ or, for logs compressed into stdout.log.gz/stderr.log.gz
+ stream,time,size,zoffset
+ Rotated (rotate=), tail-kept (ring=) and capped (maxout=) logs add rows
+ out.<n> (segment <n> starts at size), out.<n>.deleted (segment removed
+ from ring) and out.truncated (rest of stream is not logged).
+
+ usage.csv (--sample=<ms>, in status directory of each job)
+ time,userCpu,systemCpu,vsizeKb,rssKb,minorFaults,majorFaults,readChars,writeChars,readBytes,writeBytes
+
+ stdout.idx, stderr.idx (exec option index=<ms> or --index=<ms>)
+ Binary time index of stream, native byte order. Header (32 bytes):
+   char magic[8] "gpidx", u32 version, u32 recordSize,
+   i64 realtimeNs, i64 monotonicNs (clocks read together at start)
+ followed by records, one per <ms> of output at most:
+   u64 monotonicNs, u64 offset, u64 line (all ones when not counted)
+ gopard --lookup=<file> <time> binary searches it.
+
+ running.journal
+ +id,pid,runType,startTime,statusDirectory,cmd
+ -id
 
  running.csv
  id,pid,runType,startTime,statusDirectory,duration,cmd
 
+ running.journal is append-only log of runs started and finished. It is
+ compacted to records of live runs (written to temporary file and renamed)
+ every JOURNAL_COMPACT_RECORDS records or at most JOURNAL_COMPACT_SECONDS
+ after runs changed. running.csv is rewritten same way, but not synced, at
+ start and after every loop iteration that started or finished runs.
+ gopard --replay=<control directory> rebuilds running.csv from journal
+ on demand.
+
  finished.csv
- id,pid,runType,returnCode,startTime,endTime,duration,statusDirectory,cmd
+ id,pid,runType,returnCode,startTime,endTime,duration,statusDirectory,outBytes,outDropped,outSegments,errBytes,errDropped,errSegments,userCpu,systemCpu,maxRssKb,minorFaults,majorFaults,voluntarySwitches,involuntarySwitches,blocksIn,blocksOut,startUs,endUs,durationUs,reason,job,attempt,cmd
+
+ duration (seconds) and durationUs are measured on CLOCK_MONOTONIC, so
+ wall clock adjustments do not affect them. startUs and endUs are
+ CLOCK_REALTIME microseconds since epoch. reason is exit, timeout (job
+ ran past timeout=), cancel (cancel:<job>) or error (logs could not be
+ opened, job was killed). job and attempt link
+ attempts of job run again with retry=.
 
 
+ status.map
+ Live table of runs, memory mapped by gopard and readable by any process
+ without system calls. Header (native byte order, 64 bytes):
+   char magic[8] "gopard\0", u32 version, u32 slotSize, u32 slots, i32 gopardPid
+ followed by <slots> records of <slotSize> bytes:
+   u64 seq, char id[48], char job[24], i32 pid, i32 runType, i32 state,
+   i32 returnCode, i64 startTime, i64 endTime, u64 outBytes, u64 errBytes
+ state is 0 free, 1 running, 2 exited. Records are updated under seqlock:
+ reader takes seq, skips record if seq is odd, copies record and retries
+ if seq changed meanwhile.
+
  gopard will exit when control process and all spawned processes are finished.
 
  I have intention to create gopard.jar. Java/Scala api to take
@@ -46,18 +174,39 @@
  ============================================================================
  */
 
+#define _GNU_SOURCE
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <libgen.h>
+#include <getopt.h>
+#include <sched.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/types.h>
+#include <time.h>
 #include <sys/time.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <limits.h>
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
 
 #define BUFF_SIZE 1024
 static char buff[BUFF_SIZE];
@@ -71,6 +220,32 @@ static char controlPath[512];
 #define ID_TEMPLATE     "d%04d%02d%02dt%02d%02d%02d"
 #define ID_EXTRACT(t)   (t)->tm_year + 1900, (t)->tm_mon + 1, (t)->tm_mday, (t)->tm_hour, (t)->tm_min, (t)->tm_sec
 
+#define TIMESTAMP_SIZE  80
+
+static uint64_t _clock_ns(clockid_t clock){
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ Formats <t> as TIMESTAMP_TEMPLATE into <out>. Last formatted second is
+ kept per thread, so rows written within same second skip localtime.
+*/
+static __thread time_t stampTime = -1;
+static __thread char stampText[TIMESTAMP_SIZE];
+static __thread int stampLength;
+
+char * _timestamp(time_t t, char * out){
+	if( t != stampTime ){
+		struct tm tm;
+		localtime_r(&t, &tm);
+		stampLength = snprintf(stampText, sizeof(stampText), TIMESTAMP_TEMPLATE, TIMESTAMP_EXTRACT(&tm));
+		stampTime = t;
+	}
+	return memcpy(out, stampText, stampLength + 1);
+}
+
 
 void mkdirs(const char *dir, bool onlyEnsureParent) {
 	struct stat s;
@@ -166,17 +341,19 @@ void _buff_free(Buff* buff){
 #define _buff_tail(b) ((b)->head+(b)->used)
 #define _buff_left(b) ((b)->size-(b)->used)
 
-void _buff_processLines(Buff *buff, void (*callback)(char *) ){
-	int next;
-	int p = 0 ;
-	while( -1 != (next = zapNextChar(buff->head+p,buff->used-p,'\n'))   ){
-		(*callback)(buff->head+p);
-		p += next;
-	}
+void _buff_consume(Buff *buff, int p){
 	buff->used -= p;
 	memmove(buff->head, buff->head+p, buff->used);
 }
 
+bool _buff_grow(Buff *buff, int limit){
+	if( buff->size >= limit ) return false;
+	int sz = buff->size * 2 > limit ? limit : buff->size * 2;
+	buff->head = realloc(buff->head, sz);
+	buff->size = sz;
+	return true;
+}
+
 
 
 
@@ -187,6 +364,8 @@ void _buff_processLines(Buff *buff, void (*callback)(char *) ){
         M(CONTROL)   \
         M(RUNNING)  \
         M(DONE)   \
+        M(QUEUED)   \
+        M(HELD)   \
 	    M(DEFAULT)
 
 typedef enum {
@@ -199,9 +378,174 @@ static const char * runTypeNames[] = {
 static Buff controlBuffer;
 static Buff inputBuffer;
 
+/*
+ Every descriptor gopard waits on is registered once in epoll as Watch,
+ edge triggered, and epoll hands back the Watch to dispatch event.
+*/
+typedef struct {
+	int fd;
+	int epoll;
+	void (*onEvent)(void * owner, uint32_t events);
+	void * owner;
+} Watch;
+
+#define MAX_EVENTS 256
+static int epollFd = -1;
+
+void _watch_init(Watch * watch, void (*onEvent)(void *, uint32_t), void * owner){
+	watch->fd = -1;
+	watch->epoll = -1;
+	watch->onEvent = onEvent;
+	watch->owner = owner;
+}
+
+int _watch_addTo(int epoll, Watch * watch, int fd, uint32_t events){
+	struct epoll_event ev;
+	ev.events = events | EPOLLET;
+	ev.data.ptr = watch;
+	if( -1 == epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev) ){
+		fprintf(stderr, "epoll add fd(%d) failed. errno:%s(%d)\n", fd, strerror(errno),errno);
+		return -1;
+	}
+	watch->fd = fd;
+	watch->epoll = epoll;
+	return 0;
+}
+
+#define _watch_add(watch, fd, events) _watch_addTo(epollFd, watch, fd, events)
+
+void _watch_del(Watch * watch){
+	if( watch->fd > -1 ){
+		epoll_ctl(watch->epoll, EPOLL_CTL_DEL, watch->fd, NULL);
+		watch->fd = -1;
+	}
+}
+
+void _watch_close(Watch * watch){
+	int fd = watch->fd;
+	_watch_del(watch);
+	if( fd > -1 ) close(fd);
+}
+
+void _fd_setNonBlocking(int fd){
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/*
+ Deadlines are kept in hierarchical timer wheel: TIMER_LEVELS wheels of
+ TIMER_SLOTS slots, level n slot covering TIMER_SLOTS^n ticks. One timerfd
+ ticks every TIMER_TICK_MS while any timer is pending. Start, stop and
+ expiry are O(1); when lower wheel wraps, next slot of upper wheel is
+ moved down.
+*/
+#define TIMER_TICK_MS 10
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+
+typedef struct Timer {
+	struct Timer * next;
+	struct Timer ** pprev;
+	uint64_t expires;
+	void (*onExpire)(void * owner);
+	void * owner;
+} Timer;
+
+static Timer * timerWheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t timerTick = 0;
+static int timerCount = 0;
+static Watch timerWatch;
+
+static uint64_t _timer_now(){
+	return _clock_ns(CLOCK_MONOTONIC) / 1000000 / TIMER_TICK_MS;
+}
+
+static void _timer_arm(long ms){
+	struct itimerspec spec = {
+			{ ms / 1000, ms % 1000 * 1000000 },
+			{ ms / 1000, ms % 1000 * 1000000 } };
+	timerfd_settime(timerWatch.fd, 0, &spec, NULL);
+}
+
+static void _timer_link(Timer * timer){
+	uint64_t delta = timer->expires > timerTick ? timer->expires - timerTick : 0;
+	int level = 0;
+	while( level < TIMER_LEVELS - 1 && delta >> (TIMER_BITS * (level + 1)) ) level += 1;
+	uint64_t at = delta ? timer->expires : timerTick;
+	Timer ** slot = &timerWheel[level][(at >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1)];
+	timer->next = *slot;
+	if( *slot ) (*slot)->pprev = &(timer->next);
+	timer->pprev = slot;
+	*slot = timer;
+}
+
+static void _timer_unlink(Timer * timer){
+	*(timer->pprev) = timer->next;
+	if( timer->next ) timer->next->pprev = timer->pprev;
+	timer->pprev = NULL;
+}
+
+void _timer_stop(Timer * timer){
+	if( !timer->pprev ) return;
+	_timer_unlink(timer);
+	if( --timerCount == 0 ) _timer_arm(0);
+}
+
+void _timer_start(Timer * timer, long ms, void (*onExpire)(void *), void * owner){
+	_timer_stop(timer);
+	if( timerCount++ == 0 ){
+		timerTick = _timer_now();
+		_timer_arm(TIMER_TICK_MS);
+	}
+	long ticks = (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	timer->expires = timerTick + (ticks > 0 ? ticks : 1);
+	timer->onExpire = onExpire;
+	timer->owner = owner;
+	_timer_link(timer);
+}
+
+static void _timer_advance(){
+	timerTick += 1;
+	int top = 0;
+	while( top < TIMER_LEVELS - 1 && !(timerTick & ((1UL << (TIMER_BITS * (top + 1))) - 1)) ) top += 1;
+	for (int level = top; level > 0; --level) {
+		Timer ** slot = &timerWheel[level][(timerTick >> (TIMER_BITS * level)) & (TIMER_SLOTS - 1)];
+		Timer * timer = *slot;
+		*slot = NULL;
+		while( timer ){
+			Timer * next = timer->next;
+			_timer_link(timer);
+			timer = next;
+		}
+	}
+	Timer ** slot = &timerWheel[0][timerTick & (TIMER_SLOTS - 1)];
+	while( *slot ){
+		Timer * timer = *slot;
+		_timer_stop(timer);
+		(*timer->onExpire)(timer->owner);
+	}
+}
+
+void _timer_onTick(void * owner, uint32_t events){
+	uint64_t expirations;
+	while( read(timerWatch.fd, &expirations, sizeof(expirations)) == sizeof(expirations) );
+	uint64_t now = _timer_now();
+	while( timerCount > 0 && timerTick < now ) _timer_advance();
+}
+
+void _timer_init(){
+	_watch_init(&timerWatch, &_timer_onTick, NULL);
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if( fd == -1 || -1 == _watch_add(&timerWatch, fd, EPOLLIN) ){
+		fprintf(stderr,"timer failed. errno:%s(%d)\n", strerror(errno), errno);
+		exit(1);
+	}
+}
+
 typedef struct {
 	bool stored;
 	size_t size;
+	size_t zoffset;
 	time_t time;
 } PipeEvent;
 
@@ -211,76 +555,173 @@ void _event_set(PipeEvent * event, size_t size){
 	event->time = time(0);
 }
 
-void _event_set_iftime(PipeEvent * event, size_t size){
-	if( event->size < size && event->time < (time(0) - 9) ){
+bool _event_due(PipeEvent * event, size_t size){
+	return event->size < size && event->time < (time(0) - 9);
+}
+
+bool _event_set_iftime(PipeEvent * event, size_t size){
+	if( _event_due(event, size) ){
 		_event_set(event, size);
+		return true;
 	}
+	return false;
 }
 
-typedef struct  {
+typedef struct Run Run;
+typedef struct Job Job;
+
+typedef struct FilePipe_ {
 	int in;
 	int out;
 	size_t counter;
 	PipeEvent event;
 	char* name;
+	Watch watch;
+	Run * run;
+	Buff * buff;
+	void (*callback)(Buff*);
+	size_t (*capture)(struct FilePipe_ *);
+	size_t frameSize;
+	size_t frameIn;
+	size_t zcounter;
+	void * z;
+	size_t limit;
+	size_t rotate;
+	size_t ring;
+	int segment;
+	size_t segmentStart;
+	size_t dropped;
+	int pathType;
+	FILE * timeIndex;
+	uint64_t indexStep;
+	uint64_t indexLast;
+	uint64_t lines;
+	size_t written;
+	int uringBuffer;
+	bool uringRead;
+	int uringWrites;
+	struct FilePipe_ * uringNext;
+	struct Outlet * outlet;
+	char * chunk;
+	size_t chunkUsed;
+	uint64_t chunkTime;
+	struct FilePipe_ * dirtyPrev;
+	struct FilePipe_ * dirtyNext;
+	bool dirty;
+	bool sync;
+	bool empty;
+	bool detached;
 } FilePipe;
 
-void _pipe_init(FilePipe * pipe, char * name){
+void _pipe_onEvent(void * owner, uint32_t events);
+size_t _pipe_copy(FilePipe * pipe);
+size_t _pipe_splice(FilePipe * pipe);
+
+/*
+ copy - read into shared buffer and write to log
+ splice - move pages from job pipe to log without user space copy
+*/
+static bool spliceCapture = false;
+static int pipeSize = 0;
+static long compressFrame = 0;
+static long maxOutput = 0;
+static long rotateOutput = 0;
+static long ringOutput = 0;
+static long indexMillis = 0;
+static long sampleMillis = 0;
+
+void _pipe_init(FilePipe * pipe, char * name, Run * run){
 	pipe->counter = 0;
 	_event_set(&(pipe->event),0);
 	pipe->in = -1;
 	pipe->out = -1;
 	pipe->name = name;
+	pipe->run = run;
+	pipe->buff = &inputBuffer;
+	pipe->callback = &_buff_reset;
+	pipe->capture = spliceCapture ? &_pipe_splice : &_pipe_copy;
+	pipe->frameSize = 0;
+	pipe->frameIn = 0;
+	pipe->zcounter = 0;
+	pipe->z = NULL;
+	pipe->limit = 0;
+	pipe->rotate = 0;
+	pipe->ring = 0;
+	pipe->segment = 0;
+	pipe->segmentStart = 0;
+	pipe->dropped = 0;
+	pipe->timeIndex = NULL;
+	pipe->indexStep = 0;
+	pipe->indexLast = 0;
+	pipe->lines = 0;
+	pipe->written = 0;
+	pipe->uringBuffer = -1;
+	pipe->uringRead = false;
+	pipe->uringWrites = 0;
+	pipe->uringNext = NULL;
+	pipe->outlet = NULL;
+	pipe->chunk = NULL;
+	pipe->chunkUsed = 0;
+	pipe->dirtyPrev = pipe->dirtyNext = NULL;
+	pipe->dirty = false;
+	pipe->sync = false;
+	pipe->empty = false;
+	pipe->detached = false;
+	_watch_init(&(pipe->watch), &_pipe_onEvent, pipe);
 }
 
+void _uring_submit();
+bool _pipe_closeOutlet(FilePipe * pipe, bool * paused);
+
 void _pipe_free(FilePipe* pipe){
+	_uring_submit();
+	_watch_del(&(pipe->watch));
 	close(pipe->in);
-	close(pipe->out);
-}
-
-size_t _pipe_copy(FilePipe * pipe, fd_set * set, Buff* buff, void (*callback)(Buff*)){
-	ssize_t cnt = 0 ;
-	if( FD_ISSET(pipe->in,set) ){
-		char *tail = _buff_tail(buff);
-		cnt = read(pipe->in,tail,_buff_left(buff));
-		if(cnt<0){
-			if( errno != EAGAIN) {
-				fprintf(stderr, "copy: read failed: errno=%s(%d)\n", strerror(errno),errno);
-			}
-		}else if(cnt>0) {
-			_event_set_iftime(&(pipe->event),pipe->counter);
-			write(pipe->out,tail,cnt);
-			pipe->counter += cnt;
-			buff->used +=cnt;
-			if(callback) (*callback)(buff);
-		}
-		//printf("copy fd(%d) count=%ld\n",pipe->in,cnt);
+	if( !_pipe_closeOutlet(pipe, NULL) ){
+		if( pipe->sync ) fdatasync(pipe->out);
+		close(pipe->out);
 	}
-	return cnt;
+	if( pipe->timeIndex ) fclose(pipe->timeIndex);
 }
 
 typedef enum {
 	DIRECTORY,
 	OUT_FILE,
 	ERR_FILE,
+	OUT_GZ_FILE,
+	ERR_GZ_FILE,
 	INDEX_FILE,
 	RUNNING_FILE,
 	INVOKED_FILE,
 	FINISHED_FILE,
+	QUEUED_FILE,
+	JOURNAL_FILE,
+	STATUS_FILE,
+	OUT_TIME_INDEX_FILE,
+	ERR_TIME_INDEX_FILE,
+	USAGE_FILE,
 } PathType;
 
 static char *pathSuffix[] = {
 		"",
 		"/stdout.log",
 		"/stderr.log",
+		"/stdout.log.gz",
+		"/stderr.log.gz",
 		"/stdindex.csv",
 		"/running.csv",
 		"/invoked.csv",
 		"/finished.csv",
+		"/queued.csv",
+		"/running.journal",
+		"/status.map",
+		"/stdout.idx",
+		"/stderr.idx",
+		"/usage.csv",
 };
 
 
-typedef struct  {
+struct Run {
 	char *id;
 	RunType runType;
 	pid_t pid;
@@ -288,11 +729,313 @@ typedef struct  {
 	FilePipe std_err;
 	FILE * index;
 	int control_in ;
+	Watch exitWatch;
+	bool exited;
+	Run * prev;
+	Run * next;
+	Run * pidNext;
+	Run * idNext;
+	Run * exitedNext;
+	Run * detachedNext;
 	time_t start;
 	time_t end;
+	uint64_t startMono;
+	uint64_t endMono;
+	uint64_t startReal;
+	uint64_t endReal;
 	int returnCode;
+	Timer timer;
+	Timer reapTimer;
+	int fds;
+	bool terminating;
+	const char * reason;
+	struct rusage usage;
+	FILE * usageLog;
+	char * cgroup;
+	struct Worker * worker;
+	bool uring;
 	char * cmd ;
-} Run;
+	Job * job;
+};
+
+/*
+ Job is what control asked to execute. It is allocated as one block
+ holding command line copy, and lives until its run is finished.
+*/
+struct Job {
+	char name[24];
+	unsigned long seq;
+	int priority;
+	long compress;
+	long maxOutput;
+	long rotate;
+	long ring;
+	long index;
+	long limits[4];
+	int nice;
+	int ioprio;
+	long memoryMax;
+	double cpus;
+	int sync;
+	bool stdinPipe;
+	char * stdinPath;
+	struct JobInput * input;
+	long timeout;
+	long grace;
+	int retries;
+	int attempt;
+	long backoff;
+	uint64_t retryOn[4];
+	Timer retryTimer;
+	char * after[2];
+	struct Edge * edges;
+	int edgeCount;
+	int waiting;
+	bool depFailed;
+	struct Edge * dependants;
+	Job * skipNext;
+	bool named;
+	char ** env;
+	int envCount;
+	char * cwd;
+	Run * run;
+	Job * indexNext;
+	time_t queued;
+	char ** argv;
+};
+
+/*
+ exec options setting rlimits of job, in order of Job.limits
+*/
+static const struct {
+	const char * name;
+	int resource;
+} jobLimits[] = {
+		{ "as", RLIMIT_AS },
+		{ "cpu", RLIMIT_CPU },
+		{ "nofile", RLIMIT_NOFILE },
+		{ "nproc", RLIMIT_NPROC },
+};
+#define JOB_LIMITS (sizeof(jobLimits) / sizeof(jobLimits[0]))
+#define NO_NICE 100
+#define IOPRIO_CLASS_SHIFT 13
+
+static unsigned long jobSeq = 0;
+
+Job* _job_new(char ** argv){
+	size_t size = sizeof(Job);
+	int argc = 0;
+	for (; argv[argc]; ++argc) {
+		size += sizeof(char*) + strlen(argv[argc]) + 1;
+	}
+	size += sizeof(char*);
+	Job * job = malloc(size);
+	job->seq = ++jobSeq;
+	snprintf(job->name, sizeof(job->name), "j%lu", job->seq);
+	job->priority = 0;
+	job->compress = -1;
+	job->maxOutput = -1;
+	job->rotate = -1;
+	job->ring = -1;
+	job->index = -1;
+	for (int i = 0; i < JOB_LIMITS; ++i) {
+		job->limits[i] = -1;
+	}
+	job->nice = NO_NICE;
+	job->ioprio = -1;
+	job->memoryMax = -1;
+	job->cpus = 0;
+	job->sync = -1;
+	job->stdinPipe = false;
+	job->stdinPath = NULL;
+	job->input = NULL;
+	job->timeout = -1;
+	job->grace = -1;
+	job->retries = 0;
+	job->attempt = 1;
+	job->backoff = 1000;
+	memset(job->retryOn, 0, sizeof(job->retryOn));
+	job->retryTimer.pprev = NULL;
+	job->after[0] = job->after[1] = NULL;
+	job->edges = NULL;
+	job->edgeCount = 0;
+	job->waiting = 0;
+	job->depFailed = false;
+	job->dependants = NULL;
+	job->named = false;
+	job->env = NULL;
+	job->envCount = 0;
+	job->cwd = NULL;
+	job->run = NULL;
+	job->indexNext = NULL;
+	job->queued = 0;
+	job->argv = (char**)(job + 1);
+	char * p = (char*)(job->argv + argc + 1);
+	for (int i = 0; i < argc; ++i) {
+		job->argv[i] = strcpy(p, argv[i]);
+		p += strlen(p) + 1;
+	}
+	job->argv[argc] = NULL;
+	return job;
+}
+
+/*
+ Length of variable name in <name>=<value> or <name>
+*/
+static size_t _env_nameLength(const char * var){
+	const char * eq = strchr(var, '=');
+	return eq ? (size_t)(eq - var) : strlen(var);
+}
+
+static bool _env_sameName(const char * a, const char * b){
+	size_t n = _env_nameLength(a);
+	return n == _env_nameLength(b) && 0 == strncmp(a, b, n);
+}
+
+void _job_setEnv(Job * job, const char * var){
+	for (int i = 0; i < job->envCount; ++i) {
+		if( _env_sameName(job->env[i], var) ){
+			free(job->env[i]);
+			job->env[i] = strdup(var);
+			return;
+		}
+	}
+	job->env = realloc(job->env, sizeof(char*) * (job->envCount + 1));
+	job->env[job->envCount++] = strdup(var);
+}
+
+static bool _option_invalid(const char * key, const char * value){
+	fprintf(stderr,"Invalid value of exec option %s=%s\n", key, value);
+	return false;
+}
+
+/*
+ Reports unknown option and invalid value itself.
+*/
+bool _job_setOption(Job * job, char * key, char * value){
+	if( 0 == strcmp(key, "priority") ){
+		job->priority = atoi(value);
+	}else if( 0 == strcmp(key, "compress") ){
+		job->compress = atol(value);
+	}else if( 0 == strcmp(key, "maxout") ){
+		job->maxOutput = atol(value);
+	}else if( 0 == strcmp(key, "rotate") ){
+		job->rotate = atol(value);
+	}else if( 0 == strcmp(key, "ring") ){
+		job->ring = atol(value);
+	}else if( 0 == strcmp(key, "index") ){
+		job->index = atol(value);
+	}else if( 0 == strcmp(key, "nice") ){
+		job->nice = atoi(value);
+	}else if( 0 == strcmp(key, "ionice") ){
+		/* <class>[:<level>], class rt, be, idle or 1..3 */
+		int ioClass = atoi(value);
+		if( 0 == strncmp(value, "rt", 2) ) ioClass = 1;
+		if( 0 == strncmp(value, "be", 2) ) ioClass = 2;
+		if( 0 == strncmp(value, "idle", 4) ) ioClass = 3;
+		char * level = strchr(value, ':');
+		if( ioClass < 1 || ioClass > 3 ) return _option_invalid(key, value);
+		job->ioprio = ioClass << IOPRIO_CLASS_SHIFT | (level ? atoi(level + 1) & 7 : 4);
+	}else if( 0 == strcmp(key, "memory") ){
+		job->memoryMax = atol(value);
+	}else if( 0 == strcmp(key, "cpus") ){
+		job->cpus = atof(value);
+	}else if( 0 == strcmp(key, "sync") ){
+		job->sync = atoi(value);
+	}else if( 0 == strcmp(key, "timeout") ){
+		job->timeout = atol(value);
+	}else if( 0 == strcmp(key, "grace") ){
+		job->grace = atol(value);
+	}else if( 0 == strcmp(key, "retry") ){
+		job->retries = atoi(value);
+	}else if( 0 == strcmp(key, "retryon") ){
+		for (char * code = value; *code; ) {
+			char * end;
+			long n = strtol(code, &end, 10);
+			if( end == code || n < 0 || n > 255 || (*end && *end != ',') ) return _option_invalid(key, value);
+			job->retryOn[n / 64] |= (uint64_t)1 << (n % 64);
+			code = *end ? end + 1 : end;
+		}
+	}else if( 0 == strcmp(key, "backoff") ){
+		job->backoff = atol(value);
+	}else if( 0 == strcmp(key, "id") ){
+		if( !*value || strlen(value) >= sizeof(job->name) || strchr(value, ',') ) return _option_invalid(key, value);
+		strcpy(job->name, value);
+		job->named = true;
+	}else if( 0 == strcmp(key, "env") ){
+		if( !*value || *value == '=' ) return _option_invalid(key, value);
+		_job_setEnv(job, value);
+	}else if( 0 == strcmp(key, "cwd") ){
+		free(job->cwd);
+		job->cwd = strdup(value);
+	}else if( 0 == strcmp(key, "after") || 0 == strcmp(key, "afterany") ){
+		int any = key[5] != 0;
+		free(job->after[any]);
+		job->after[any] = strdup(value);
+	}else if( 0 == strcmp(key, "stdin") ){
+		free(job->stdinPath);
+		job->stdinPath = NULL;
+		job->stdinPipe = 0 == strcmp(value, "pipe");
+		if( !job->stdinPipe ) job->stdinPath = strdup(value);
+	}else{
+		for (int i = 0; i < JOB_LIMITS; ++i) {
+			if( 0 == strcmp(key, jobLimits[i].name) ){
+				job->limits[i] = atol(value);
+				return true;
+			}
+		}
+		fprintf(stderr,"Unknown exec option=%s\n",key);
+		return false;
+	}
+	return true;
+}
+
+/*
+ Jobs submitted and not finished yet, by name.
+*/
+#define JOB_INDEX 0x1000
+static Job * jobIndex[JOB_INDEX];
+
+static unsigned _hash_string(const char * s){
+	unsigned h = 2166136261u;
+	while( *s ){
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+Job * _job_find(const char * name){
+	Job * job = jobIndex[_hash_string(name) & (JOB_INDEX - 1)];
+	while( job && strcmp(job->name, name) ) job = job->indexNext;
+	return job;
+}
+
+void _job_index(Job * job){
+	Job ** bucket = jobIndex + (_hash_string(job->name) & (JOB_INDEX - 1));
+	job->indexNext = *bucket;
+	*bucket = job;
+}
+
+void _input_free(Job * job);
+
+void _job_free(Job * job){
+	Job ** p = jobIndex + (_hash_string(job->name) & (JOB_INDEX - 1));
+	while( *p && *p != job ) p = &((*p)->indexNext);
+	if( *p ) *p = job->indexNext;
+	_timer_stop(&(job->retryTimer));
+	if( job->input ) _input_free(job);
+	free(job->after[0]);
+	free(job->after[1]);
+	free(job->edges);
+	for (int i = 0; i < job->envCount; ++i) {
+		free(job->env[i]);
+	}
+	free(job->env);
+	free(job->cwd);
+	free(job->stdinPath);
+	free(job);
+}
 
 char* _run_path(Run * run , RunType rt, PathType pt){
 	if(rt == DEFAULT){
@@ -302,19 +1045,99 @@ char* _run_path(Run * run , RunType rt, PathType pt){
 	return buff;
 }
 
-#define MAX_RUN FD_SETSIZE/2
-static int maxRun=MAX_RUN;
-static Run* runs[MAX_RUN];
+/*
+ Each run holds stdout/stderr pipes, two log files, index file and pidfd
+ open, plus time indexes, stdin pipe and usage.csv when enabled, so number
+ of runs is bounded by RLIMIT_NOFILE. Spawning takes SPAWN_FDS more for a
+ moment (child pipe ends, cgroup.procs).
+*/
+#define RUN_FDS 6
+#define SPAWN_FDS 4
+#define RESERVED_FDS 64
+static int maxRun;
+static int fdLimit;
+static int fdsInUse = 0;
+
+int _run_fds(Job * job){
+	int fds = RUN_FDS;
+	long ms = job && job->index >= 0 ? job->index : indexMillis;
+	if( ms > 0 ) fds += 2;
+	if( job && job->stdinPipe ) fds += 1;
+	if( sampleMillis > 0 ) fds += 1;
+	return fds;
+}
 static Run* ctrlRun;
 
+/*
+ Run slots live in one slab allocated at startup. Free slots are chained
+ in free list, live runs in doubly linked list in start order, and live
+ runs are indexed by pid and by id in chained hash tables.
+*/
+static Run * slab;
+static Run * freeRuns;
+static Run * liveHead;
+static Run * liveTail;
+static Run ** pidIndex;
+static Run ** idIndex;
+static unsigned indexMask;
+static int runningCount = 0;
+static struct rlimit childNoFile;
+
+/*
+ Child exits are events in main loop: pidfd per run when kernel
+ supports it, otherwise one signalfd for SIGCHLD.
+*/
+static bool usePidfd;
+static Watch childWatch;
+static sigset_t childMask;
+static Run * exitedHead;
+static Run * exitedTail;
+
 static FILE * invoked ;
 static FILE * finished ;
+static FILE * queued ;
+static char * runningPath ;
+static char * journalPath ;
+static FILE * journal ;
+static int journalRecords = 0;
+static time_t journalCompacted = 0;
+static bool journalDirty = false;
+static Timer compactTimer;
 
+#define JOURNAL_COMPACT_RECORDS 4096
+#define JOURNAL_COMPACT_SECONDS 10
 
 
 void _runs_init(){
-	for (int i=0; i<maxRun; ++i) {
-    	runs[i] = (Run*)0;
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	childNoFile = rl;
+	if( rl.rlim_cur < rl.rlim_max ){
+		rl.rlim_cur = rl.rlim_max;
+		if( -1 == setrlimit(RLIMIT_NOFILE, &rl) ){
+			getrlimit(RLIMIT_NOFILE, &rl);
+		}
+	}
+	rlim_t fds = rl.rlim_cur;
+	if( fds == RLIM_INFINITY || fds > 0x100000 ){
+		fds = 0x100000;
+	}
+	fdLimit = fds;
+	int perRun = _run_fds(NULL);
+	maxRun = fds > RESERVED_FDS + perRun ? (fds - RESERVED_FDS) / perRun : 1 ;
+	slab = calloc(maxRun, sizeof(Run));
+	for (int i = maxRun - 1; i >= 0; --i) {
+		slab[i].next = freeRuns;
+		freeRuns = slab + i;
+	}
+	for (indexMask = 1; indexMask < (unsigned)maxRun * 2; indexMask <<= 1);
+	pidIndex = calloc(indexMask, sizeof(Run*));
+	idIndex = calloc(indexMask, sizeof(Run*));
+	indexMask -= 1;
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if( epollFd == -1 ){
+		perror("epoll_create1");
+		exit(1);
 	}
 }
 
@@ -325,38 +1148,179 @@ static char* toId(time_t tt, pid_t pid){
 	return p;
 }
 
-static char* toCmd(char ** cmdArray){
+static char* formatCmd(char ** cmdArray){
 	buff[0] = 0 ;
 	while(*cmdArray){
 		strncat(buff, *cmdArray, sizeof(buff) - strlen(buff) - 1);
 		strncat(buff, " ", sizeof(buff) - strlen(buff) - 1);
 		cmdArray++;
 	}
-	return strdup(buff);
+	return buff;
+}
+
+static char* toCmd(char ** cmdArray){
+	return strdup(formatCmd(cmdArray));
+}
+
+static unsigned _hash_pid(pid_t pid){
+	return ((unsigned)pid * 2654435761u) & indexMask;
+}
+
+static unsigned _hash_id(const char * id){
+	return _hash_string(id) & indexMask;
+}
+
+Run* _runs_findByPid(pid_t pid){
+	Run * run = pidIndex[_hash_pid(pid)];
+	while( run && run->pid != pid ) run = run->pidNext;
+	return run;
+}
+
+Run* _runs_findById(const char * id){
+	Run * run = idIndex[_hash_id(id)];
+	while( run && strcmp(run->id, id) ) run = run->idNext;
+	return run;
 }
 
 Run* _runs_add(RunType type, time_t tt, pid_t pid, char ** cmdArray ){
-	int runIdx=0;
-	for(;;){
-		if(!runs[runIdx]) break;
-		runIdx += 1;
-		if( runIdx >= maxRun) return NULL;
-	}
-	Run * run = malloc(sizeof(Run));
-	runs[runIdx] = run;
+	Run * run = freeRuns;
+	if( !run ) return NULL;
+	freeRuns = run->next;
+	run -> prev = liveTail;
+	run -> next = NULL;
+	if( liveTail ) liveTail->next = run; else liveHead = run;
+	liveTail = run;
 	run -> runType = type;
 	run -> id = toId(tt,pid);
 	run -> pid = pid ;
-	_pipe_init(&(run->std_out),"out");
-	_pipe_init(&(run->std_err),"err");
+	Run ** bucket = pidIndex + _hash_pid(pid);
+	run -> pidNext = *bucket;
+	*bucket = run;
+	bucket = idIndex + _hash_id(run->id);
+	run -> idNext = *bucket;
+	*bucket = run;
+	_pipe_init(&(run->std_out),"out",run);
+	_pipe_init(&(run->std_err),"err",run);
 	run -> index = NULL;
 	run -> start = tt;
+	run -> startMono = _clock_ns(CLOCK_MONOTONIC);
+	run -> startReal = _clock_ns(CLOCK_REALTIME);
 	run -> end = 0;
 	run -> control_in = -1;
+	run -> exited = false;
+	run -> timer.pprev = NULL;
+	run -> reapTimer.pprev = NULL;
+	run -> terminating = false;
+	run -> reason = "exit";
+	run -> job = NULL;
 	run -> cmd = toCmd(cmdArray);
 	return run;
 }
 
+void _runs_remove(Run * run){
+	Run ** link;
+	for( link = pidIndex + _hash_pid(run->pid); *link != run; link = &((*link)->pidNext) );
+	*link = run->pidNext;
+	for( link = idIndex + _hash_id(run->id); *link != run; link = &((*link)->idNext) );
+	*link = run->idNext;
+	if( run->prev ) run->prev->next = run->next; else liveHead = run->next;
+	if( run->next ) run->next->prev = run->prev; else liveTail = run->prev;
+	run->next = freeRuns;
+	freeRuns = run;
+}
+
+
+#define STATUS_VERSION 1
+#define STATUS_FREE    0
+#define STATUS_RUNNING 1
+#define STATUS_EXITED  2
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t slotSize;
+	uint32_t slots;
+	int32_t pid;
+	char reserved[40];
+} StatusHeader;
+
+typedef struct {
+	uint64_t seq;
+	char id[48];
+	char job[24];
+	int32_t pid;
+	int32_t runType;
+	int32_t state;
+	int32_t returnCode;
+	int64_t start;
+	int64_t end;
+	uint64_t outBytes;
+	uint64_t errBytes;
+} StatusSlot;
+
+static StatusHeader * statusMap;
+static StatusSlot * statusSlots;
+static size_t statusMapSize;
+
+void _status_init(const char * path){
+	statusMapSize = sizeof(StatusHeader) + sizeof(StatusSlot) * maxRun;
+	int fd = open(path, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if( fd == -1 || -1 == ftruncate(fd, statusMapSize) ||
+			MAP_FAILED == (statusMap = mmap(NULL, statusMapSize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) ){
+		fprintf(stderr,"status map %s failed. errno:%s(%d) \n", path, strerror(errno),errno);
+		statusMap = NULL;
+	}else{
+		memcpy(statusMap->magic, "gopard", 7);
+		statusMap->version = STATUS_VERSION;
+		statusMap->slotSize = sizeof(StatusSlot);
+		statusMap->slots = maxRun;
+		statusMap->pid = getpid();
+		statusSlots = (StatusSlot*)(statusMap + 1);
+	}
+	if( fd > -1 ) close(fd);
+}
+
+static StatusSlot * _status_begin(Run * run){
+	if( !statusMap ) return NULL;
+	StatusSlot * slot = statusSlots + (run - slab);
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return slot;
+}
+
+static void _status_end(StatusSlot * slot){
+	__atomic_store_n(&slot->seq, slot->seq + 1, __ATOMIC_RELEASE);
+}
+
+void _status_publish(Run * run, int state){
+	StatusSlot * slot = _status_begin(run);
+	if( !slot ) return;
+	snprintf(slot->id, sizeof(slot->id), "%s", run->id);
+	snprintf(slot->job, sizeof(slot->job), "%s", run->job ? run->job->name : "");
+	slot->pid = run->pid;
+	slot->runType = run->runType;
+	slot->state = state;
+	slot->returnCode = run->returnCode;
+	slot->start = run->start;
+	slot->end = run->end;
+	/* counters of run on worker come with its messages */
+	if( !run->worker ){
+		slot->outBytes = run->std_out.counter;
+		slot->errBytes = run->std_err.counter;
+	}
+	_status_end(slot);
+}
+
+void _status_setCounters(Run * run, size_t outBytes, size_t errBytes){
+	StatusSlot * slot = _status_begin(run);
+	if( !slot ) return;
+	slot->outBytes = outBytes;
+	slot->errBytes = errBytes;
+	_status_end(slot);
+}
+
+#define _status_counters(run) _status_setCounters(run, (run)->std_out.counter, (run)->std_err.counter)
+
 
 char* _run_mkdir(Run* run){
 	char *path = _run_path(run,DEFAULT,DIRECTORY);
@@ -364,187 +1328,3315 @@ char* _run_mkdir(Run* run){
 	return path;
 }
 
+static int _pidfd_open(pid_t pid){
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
 
-Run* _run_open(Run* run, int inputStdOut, int inputStdErr){
-	run->std_out.in = inputStdOut;
-	run->std_err.in = inputStdErr;
-	_run_mkdir(run);
-//	printf("open err=%d, out=%d\n", run->std_err.in, run->std_out.in );
-	run->std_out.out = open(_run_path(run, DEFAULT, OUT_FILE), O_WRONLY|O_CREAT , 0644);
-	run->std_err.out = open(_run_path(run, DEFAULT, ERR_FILE), O_WRONLY|O_CREAT , 0644);
-	run->index = fopen(_run_path(run, DEFAULT, INDEX_FILE), "w");
-	fprintf(run->index,"stream,time,size\n");
-	return run;
+void _pipe_finalOutlet(FilePipe * pipe);
+
+void _run_finishing(Run* run){
+	_pipe_finalOutlet(&(run->std_out));
+	_pipe_finalOutlet(&(run->std_err));
+	run->exitedNext = NULL;
+	if( exitedTail ) exitedTail->exitedNext = run; else exitedHead = run;
+	exitedTail = run;
 }
 
-void _run_storePipeEvent(Run * run, FilePipe * pipe) {
-	if (!pipe->event.stored) {
-		struct tm * t = localtime(&(pipe->event.time));
-		fprintf(run->index, "%s,"         TIMESTAMP_TEMPLATE  ",%ld\n",
-				             pipe->name,  TIMESTAMP_EXTRACT(t), pipe->event.size);
-		pipe->event.stored = true;
+void _worker_detach(Run * run);
+void _uring_detach(Run * run);
+
+void _run_exited(Run* run, int status, struct rusage * usage){
+	run->returnCode = status;
+	run->usage = *usage;
+	run->end = time(0);
+	run->endMono = _clock_ns(CLOCK_MONOTONIC);
+	run->endReal = _clock_ns(CLOCK_REALTIME);
+	run->exited = true;
+	_timer_stop(&(run->timer));
+	_timer_stop(&(run->reapTimer));
+	_status_publish(run, STATUS_EXITED);
+	_watch_close(&(run->exitWatch));
+	if( run->worker ){
+		/* finished when worker hands pipes back */
+		_worker_detach(run);
+	}else if( run->uring ){
+		/* finished when posted reads are completed or cancelled */
+		_uring_detach(run);
+	}else{
+		_run_finishing(run);
 	}
 }
 
+/*
+ Jobs run in their own process group, so signals reach whatever job
+ started too. SIGTERM goes first and SIGKILL follows unless job exits
+ within grace period.
+*/
+static long timeoutMillis = 0;
+static long graceMillis = 5000;
 
-void _run_free(Run* run){
-	if(run->control_in > -1) close(run->control_in);
-	_event_set(&(run->std_out.event),run->std_out.counter);
-	_event_set(&(run->std_err.event),run->std_err.counter);
-	_run_storePipeEvent(run,&(run->std_out));
-	_run_storePipeEvent(run,&(run->std_err));
-	_pipe_free(&(run->std_err));
-	_pipe_free(&(run->std_out));
+static void _run_signal(Run * run, int sig){
+	if( -1 == kill(-run->pid, sig) && -1 == kill(run->pid, sig) ){
+		fprintf(stderr,"kill %d failed. errno:%s(%d)\n", run->pid, strerror(errno), errno);
+	}
+}
 
-    //TODO move to separate method
-	//id,pid,runType,returnCode,startTime,endTime,duration,statusDirectory,cmd
-	char * finalPath ;
-	if(run->runType == CONTROL){
-		finalPath = _run_path(run,CONTROL,DIRECTORY);
+static void _run_kill(void * owner){
+	_run_signal(owner, SIGKILL);
+}
+
+void _run_terminate(Run * run, const char * reason){
+	if( run->exited || run->terminating ) return;
+	run->terminating = true;
+	run->reason = reason;
+	long grace = run->job && run->job->grace >= 0 ? run->job->grace : graceMillis;
+	if( grace > 0 ){
+		_run_signal(run, SIGTERM);
+		_timer_start(&(run->timer), grace, &_run_kill, run);
 	}else{
-		char* moveFrom = strdup(_run_path(run,DEFAULT,DIRECTORY));
-		finalPath = _run_path(run,DONE,DIRECTORY);
-		mkdirs(finalPath,true);
-		if( -1 == rename(moveFrom,finalPath) ){
-			fprintf(stderr,"rename %s -> %s failed. errno:%s(%d) \n", moveFrom, finalPath, strerror(errno),errno);
-			finalPath = _run_path(run,DEFAULT,DIRECTORY);
-		}
-		free(moveFrom);
+		_timer_stop(&(run->timer));
+		_run_signal(run, SIGKILL);
 	}
-	struct tm start = *localtime(&(run->start));
-	struct tm end = *localtime(&(run->end));
-	fprintf(finished,"%s,%d,%s,%d," TIMESTAMP_TEMPLATE "," TIMESTAMP_TEMPLATE ",%ld,%s,%s\n",
-			run->id,
-			run->pid,
-			runTypeNames[run->runType],
-			run->returnCode,
-			TIMESTAMP_EXTRACT(&start),
-			TIMESTAMP_EXTRACT(&end),
-			run->end-run->start,
-			finalPath,
-			run->cmd
-	);
+}
 
-	fclose(run->index);
-	free(run->cmd);
-	free(run->id);
-	free(run);
+static void _run_onTimeout(void * owner){
+	_run_terminate(owner, "timeout");
 }
 
-static void _ctrlRun_init(Run* run){
-	ctrlRun = run;
-	_run_mkdir(run);
-	invoked = fopen(_run_path(ctrlRun,DEFAULT,INVOKED_FILE),"w");
-	fprintf(invoked, "id,pid,runType,startTime,statusDirectory,cmd\n");
-    finished = fopen(_run_path(ctrlRun,DEFAULT,FINISHED_FILE),"w");
-    fprintf(finished, "id,pid,runType,returnCode,startTime,endTime,duration,statusDirectory,cmd\n");
+void _run_deadline(Run * run){
+	long timeout = run->job->timeout >= 0 ? run->job->timeout : timeoutMillis;
+	if( timeout > 0 ) _timer_start(&(run->timer), timeout, &_run_onTimeout, run);
+}
 
+void _run_onExit(void * owner, uint32_t events){
+	Run * run = owner;
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	while( -1 == (pid = wait4(run->pid, &status, WNOHANG, &usage)) && errno == EINTR );
+	if( pid == run->pid ){
+		_run_exited(run, status, &usage);
+	}
 }
 
+/*
+ Run without pidfd (out of descriptors) is polled with wait4 instead.
+*/
+#define REAP_POLL_MS 50
 
-int _runs_prepareDescriptors(fd_set * readSet){
-	int maxfd = 0;
-	FD_ZERO(readSet);
-	for (int runIdx = 0; runIdx < maxRun && runs[runIdx]; ++runIdx) {
-		Run* run =runs[runIdx];
-		if(maxfd < run->std_err.in){
-			maxfd = run->std_err.in;
-		}
-		if(maxfd < run->std_out.in){
-			maxfd = run->std_out.in;
+static void _run_poll(void * owner){
+	Run * run = owner;
+	_run_onExit(run, 0);
+	if( !run->exited ) _timer_start(&(run->reapTimer), REAP_POLL_MS, &_run_poll, run);
+}
+
+void _run_watchExit(Run * run){
+	_watch_init(&(run->exitWatch), &_run_onExit, run);
+	if( usePidfd ){
+		int fd = _pidfd_open(run->pid);
+		if( fd == -1 || -1 == _watch_add(&(run->exitWatch), fd, EPOLLIN) ){
+			fprintf(stderr,"pidfd for pid %d failed, polling. errno:%s(%d) \n", run->pid, strerror(errno),errno);
+			if( fd > -1 ) close(fd);
+			_timer_start(&(run->reapTimer), REAP_POLL_MS, &_run_poll, run);
 		}
-		_run_storePipeEvent(run,&(run->std_out));
-		_run_storePipeEvent(run,&(run->std_err));
-		FD_SET(run->std_out.in,readSet);
-		FD_SET(run->std_err.in,readSet);
 	}
-	return maxfd+1;
 }
 
-void _runs_updateRunning(){
-	FILE * running =  fopen(_run_path(ctrlRun,DEFAULT,RUNNING_FILE),"w");
-	fprintf(running, "id,pid,runType,startTime,duration,statusDirectory,cmd\n");
-	for (int runIdx = 0; runIdx < maxRun && runs[runIdx]; ++runIdx) {
-		Run* run =runs[runIdx];
-		struct tm *t = localtime(&(run->start));
-		fprintf(running, "%s,%d,%s," TIMESTAMP_TEMPLATE ",%ld,%s,%s\n",
-				run->id, run->pid, runTypeNames[run->runType],
-				TIMESTAMP_EXTRACT(t),time(0)-run->start,
-				_run_path(run,DEFAULT,DIRECTORY),run->cmd  );
+void _children_onSignal(void * owner, uint32_t events){
+	struct signalfd_siginfo info;
+	while( read(childWatch.fd, &info, sizeof(info)) == sizeof(info) );
+	int status;
+	struct rusage usage;
+	pid_t pid;
+	while((pid = wait4(-1,&status, WNOHANG, &usage)) > 0 ){
+		Run * run = _runs_findByPid(pid);
+		if( run ) _run_exited(run, status, &usage);
 	}
-	fclose(running);
 }
 
-
-Run * _run_new(char ** cmd,RunType runType){
-	int  runPipes[6];
-	pipe(runPipes);
-	pipe(runPipes+2);
-	if(runType==CONTROL)
-		pipe(runPipes+4);
-	pid_t pid;
-	Run * run;
-	time_t tt = time(0);
-	if((pid = fork()) == -1){
-		perror("fork");
-		exit(1);
+void _children_init(){
+	sigprocmask(SIG_SETMASK, NULL, &childMask);
+	int fd = _pidfd_open(getpid());
+	usePidfd = fd > -1;
+	if( usePidfd ){
+		close(fd);
+		return;
 	}
-	if( pid == 0 ) {
-		close(runPipes[0]);
-		dup2(runPipes[1], STDOUT_FILENO);
-		close(runPipes[1]);
-		close(runPipes[2]);
-		dup2(runPipes[3], STDERR_FILENO);
-		close(runPipes[3]);
-		if(runType==CONTROL){
-		    dup2(runPipes[4], STDIN_FILENO);
-		    close(runPipes[4]);
-			close(runPipes[5]);
-		}
-		run = _runs_add(runType, tt, pid=getpid(),cmd);
-		chdir(_run_mkdir(run));
-		execve(cmd[0],cmd,NULL);
-		fprintf(stderr, "failed to execute errno:%s(%d) cmd:%s\n", strerror(errno),errno, run->cmd);
-		exit(-1);
-	}else{
-		run = _runs_add(runType,tt,pid,cmd);
-		close(runPipes[1]);
-		close(runPipes[3]);
-		if(runType==CONTROL){
-			close(runPipes[4]);
-			run->control_in = runPipes[5];
-			_ctrlRun_init(run);
-		}
-		_run_open(run,runPipes[0], runPipes[2]);
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	_watch_init(&childWatch, &_children_onSignal, NULL);
+	fd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	if( fd == -1 || -1 == _watch_add(&childWatch, fd, EPOLLIN) ){
+		perror("signalfd");
+		exit(1);
 	}
+}
+
+/*
+ Everything child needs is prepared in parent as SpawnPlan, so code
+ between clone/fork and execve is only syscalls and touch no heap.
+ Child creates and enters its status directory itself, because
+ directory name ends with pid which parent learns only after spawn.
+*/
+typedef struct {
+	char ** argv;
+	const char * path;
+	char ** envp;
+	const char * cwd;
+	int dups[3];
+	const char * input;
+	char dir[512];
+	size_t dirPrefix;
+	sigset_t * mask;
+	struct rlimit * noFile;
+	int limitCount;
+	int limitResource[JOB_LIMITS];
+	struct rlimit limitValue[JOB_LIMITS];
+	int nice;
+	int ioprio;
+	int cgroupProcs;
+	bool pgroup;
+	int err;
+} SpawnPlan;
+
+void _plan_init(SpawnPlan * plan, char ** argv, RunType runType, time_t tt){
+	plan->argv = argv;
+	plan->path = argv[0];
+	plan->envp = environ;
+	plan->cwd = NULL;
+	for (int fd = 0; fd < 3; ++fd) {
+		plan->dups[fd] = -1;
+	}
+	plan->input = NULL;
+	struct tm  *t = localtime(&tt);
+	plan->dirPrefix = snprintf(plan->dir, sizeof(plan->dir), "%s/%s/" ID_TEMPLATE "p",
+			statusRoot, runTypeNames[runType], ID_EXTRACT(t));
+	mkdirs(plan->dir, true);
+	plan->mask = &childMask;
+	plan->noFile = &childNoFile;
+	plan->limitCount = 0;
+	plan->nice = NO_NICE;
+	plan->ioprio = -1;
+	plan->cgroupProcs = -1;
+	plan->pgroup = false;
+	plan->err = 0;
+}
+
+void _plan_limits(SpawnPlan * plan, Job * job){
+	for (int i = 0; i < JOB_LIMITS; ++i) {
+		if( job->limits[i] < 0 ) continue;
+		plan->limitResource[plan->limitCount] = jobLimits[i].resource;
+		plan->limitValue[plan->limitCount].rlim_cur = job->limits[i];
+		plan->limitValue[plan->limitCount].rlim_max = job->limits[i];
+		plan->limitCount += 1;
+	}
+	plan->nice = job->nice;
+	plan->ioprio = job->ioprio;
+	plan->input = job->stdinPath;
+	plan->pgroup = true;
+}
+
+static void _plan_fail(SpawnPlan * plan, const char * what){
+	plan->err = errno;
+	const char * cmd = plan->argv[0];
+	write(STDERR_FILENO, "failed to ", 10);
+	write(STDERR_FILENO, what, strlen(what));
+	write(STDERR_FILENO, " cmd:", 5);
+	write(STDERR_FILENO, cmd, strlen(cmd));
+	write(STDERR_FILENO, "\n", 1);
+	_exit(127);
+}
+
+static int _plan_exec(void * arg){
+	SpawnPlan * plan = arg;
+	if( plan->pgroup ){
+		setpgid(0, 0);
+	}
+	for (int fd = 0; fd < 3; ++fd) {
+		if( plan->dups[fd] > -1 && -1 == dup2(plan->dups[fd], fd) ){
+			_plan_fail(plan, "redirect");
+		}
+	}
+	if( plan->input ){
+		int fd = open(plan->input, O_RDONLY|O_CLOEXEC);
+		if( fd == -1 || -1 == dup2(fd, STDIN_FILENO) ){
+			_plan_fail(plan, "open stdin");
+		}
+	}
+	char digits[16];
+	int n = 0;
+	for( pid_t pid = syscall(SYS_getpid); pid > 0; pid /= 10 ){
+		digits[n++] = '0' + pid % 10;
+	}
+	char * p = plan->dir + plan->dirPrefix;
+	while( n > 0 && p < plan->dir + sizeof(plan->dir) - 1 ){
+		*p++ = digits[--n];
+	}
+	*p = 0;
+	mkdir(plan->dir, 0755);
+	if( -1 == chdir(plan->cwd ? plan->cwd : plan->dir) ){
+		_plan_fail(plan, "enter");
+	}
+	if( plan->cgroupProcs > -1 ){
+		write(plan->cgroupProcs, "0", 1);
+	}
+	setrlimit(RLIMIT_NOFILE, plan->noFile);
+	for (int i = 0; i < plan->limitCount; ++i) {
+		if( -1 == setrlimit(plan->limitResource[i], plan->limitValue + i) ){
+			_plan_fail(plan, "limit");
+		}
+	}
+	if( plan->nice != NO_NICE && -1 == setpriority(PRIO_PROCESS, 0, plan->nice) ){
+		_plan_fail(plan, "nice");
+	}
+	if( plan->ioprio > -1 && -1 == syscall(SYS_ioprio_set, 1, 0, plan->ioprio) ){
+		_plan_fail(plan, "ionice");
+	}
+	struct sigaction dfl = { .sa_handler = SIG_DFL };
+	sigaction(SIGPIPE, &dfl, NULL);
+	sigprocmask(SIG_SETMASK, plan->mask, NULL);
+	execve(plan->path, plan->argv, plan->envp);
+	_plan_fail(plan, "execute");
+	return 127;
+}
+
+/*
+ With --cgroup=<dir> (writable cgroup v2 directory) every job gets its
+ own cgroup gopard<pid>.<job> there, removed after job finished. Child
+ moves itself in by writing to cgroup.procs opened by parent.
+*/
+static char * cgroupRoot = NULL;
+
+static bool _cgroup_write(const char * dir, const char * file, const char * value){
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	int fd = open(path, O_WRONLY|O_CLOEXEC);
+	bool ok = fd > -1 && write(fd, value, strlen(value)) > 0;
+	if( fd > -1 ) close(fd);
+	return ok;
+}
+
+void _cgroup_init(){
+	if( !cgroupRoot ) return;
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/cgroup.procs", cgroupRoot);
+	if( -1 == access(path, W_OK) ){
+		fprintf(stderr,"%s is not writable cgroup v2, jobs run without cgroups. errno:%s(%d)\n", cgroupRoot, strerror(errno),errno);
+		cgroupRoot = NULL;
+		return;
+	}
+	_cgroup_write(cgroupRoot, "cgroup.subtree_control", "+memory");
+	_cgroup_write(cgroupRoot, "cgroup.subtree_control", "+cpu");
+}
+
+char * _cgroup_create(Job * job, SpawnPlan * plan){
+	char path[PATH_MAX], value[64];
+	snprintf(path, sizeof(path), "%s/gopard%d.%s", cgroupRoot, getpid(), job->name);
+	if( -1 == mkdir(path, 0755) ){
+		fprintf(stderr,"cgroup %s failed. errno:%s(%d)\n", path, strerror(errno),errno);
+		return NULL;
+	}
+	if( job->memoryMax >= 0 ){
+		snprintf(value, sizeof(value), "%ld", job->memoryMax);
+		if( !_cgroup_write(path, "memory.max", value) ){
+			fprintf(stderr,"%s memory.max failed. errno:%s(%d)\n", path, strerror(errno),errno);
+		}
+	}
+	if( job->cpus > 0 ){
+		snprintf(value, sizeof(value), "%ld 100000", (long)(job->cpus * 100000));
+		if( !_cgroup_write(path, "cpu.max", value) ){
+			fprintf(stderr,"%s cpu.max failed. errno:%s(%d)\n", path, strerror(errno),errno);
+		}
+	}
+	strcat(path, "/cgroup.procs");
+	plan->cgroupProcs = open(path, O_WRONLY|O_CLOEXEC);
+	*strrchr(path, '/') = 0;
+	return strdup(path);
+}
+
+/*
+ Commands without '/' are looked up in PATH the way execvp does, but
+ parent does it once: resolved files (or absence) are cached per PATH
+ value and, when PATH has relative entries, cwd= of job; those entries
+ are cached as absolute directories. Cache of PATH is dropped when
+ modification time of any of its directories changes, which happens
+ whenever entries are added, removed or renamed there; directories are
+ checked at most once a second.
+ Caches are bounded: all of them are dropped when MAX_PATH_CACHES PATH
+ values are cached, names of one PATH when it has MAX_RESOLVED of them.
+*/
+#define PATH_CACHE 0x100
+#define MAX_PATH_CACHES 16
+#define MAX_RESOLVED 0x1000
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+typedef struct Resolved {
+	struct Resolved * next;
+	char * file;
+	char name[];
+} Resolved;
+
+typedef struct PathCache {
+	struct PathCache * next;
+	char * path;
+	char * cwd;
+	int dirCount;
+	char ** dirs;
+	char * dirBuff;
+	int resolvedCount;
+	struct timespec * mtimes;
+	time_t checked;
+	Resolved * names[PATH_CACHE];
+} PathCache;
+
+static PathCache * pathCaches = NULL;
+static int pathCacheCount = 0;
+
+static void _path_clear(PathCache * cache){
+	for (int i = 0; i < PATH_CACHE; ++i) {
+		while( cache->names[i] ){
+			Resolved * r = cache->names[i];
+			cache->names[i] = r->next;
+			free(r->file);
+			free(r);
+		}
+	}
+	cache->resolvedCount = 0;
+}
+
+static void _path_reset(){
+	while( pathCaches ){
+		PathCache * cache = pathCaches;
+		pathCaches = cache->next;
+		_path_clear(cache);
+		free(cache->path);
+		free(cache->cwd);
+		free(cache->dirs);
+		free(cache->dirBuff);
+		free(cache->mtimes);
+		free(cache);
+	}
+	pathCacheCount = 0;
+}
+
+/*
+ Empty entry, also leading or trailing ':', means current directory.
+*/
+static bool _path_relative(const char * path){
+	for (const char * p = path; ; ++p) {
+		if( *p != '/' ) return true;
+		p = strchr(p, ':');
+		if( !p ) return false;
+	}
+}
+
+static bool _path_sameCwd(const char * a, const char * b){
+	return a && b ? 0 == strcmp(a, b) : a == b;
+}
+
+/*
+ <cwd> is NULL unless <path> has relative entries.
+*/
+static PathCache * _path_cache(const char * path, const char * cwd){
+	PathCache * cache = pathCaches;
+	while( cache && (strcmp(cache->path, path) || !_path_sameCwd(cache->cwd, cwd)) ) cache = cache->next;
+	if( cache ) return cache;
+	if( pathCacheCount == MAX_PATH_CACHES ) _path_reset();
+	cache = calloc(1, sizeof(PathCache));
+	cache->path = strdup(path);
+	cache->cwd = cwd ? strdup(cwd) : NULL;
+	char base[PATH_MAX];
+	/* job can't enter cwd= that does not resolve, nothing to look up */
+	if( cwd && !realpath(cwd, base) ) cwd = NULL;
+	int count = 1;
+	for (const char * p = path; *p; ++p) count += *p == ':';
+	cache->dirs = malloc(sizeof(char*) * count);
+	cache->mtimes = calloc(count, sizeof(struct timespec));
+	char * dirs = cache->dirBuff = malloc(strlen(path) + 1 + count * (cwd ? strlen(base) + 2 : 1));
+	for (const char * p = path; p; p = strchr(p, ':') ? strchr(p, ':') + 1 : NULL) {
+		int len = strcspn(p, ":");
+		if( *p == '/' ){
+			cache->dirs[cache->dirCount++] = dirs;
+			dirs += sprintf(dirs, "%.*s", len, p) + 1;
+		}else if( cwd ){
+			cache->dirs[cache->dirCount++] = dirs;
+			dirs += sprintf(dirs, "%s/%.*s", base, len, p) + 1;
+		}
+		/* else in status directory of job, which is new and empty */
+	}
+	cache->checked = -1;
+	cache->next = pathCaches;
+	pathCaches = cache;
+	pathCacheCount += 1;
+	return cache;
+}
+
+static void _path_check(PathCache * cache){
+	time_t now = time(0);
+	if( cache->checked == now ) return;
+	cache->checked = now;
+	bool changed = false;
+	for (int i = 0; i < cache->dirCount; ++i) {
+		struct stat st;
+		if( -1 == stat(cache->dirs[i], &st) ) memset(&st, 0, sizeof(st));
+		if( st.st_mtim.tv_sec != cache->mtimes[i].tv_sec || st.st_mtim.tv_nsec != cache->mtimes[i].tv_nsec ){
+			cache->mtimes[i] = st.st_mtim;
+			changed = true;
+		}
+	}
+	if( changed ) _path_clear(cache);
+}
+
+static char * _path_search(PathCache * cache, const char * name){
+	char file[PATH_MAX];
+	for (int i = 0; i < cache->dirCount; ++i) {
+		snprintf(file, sizeof(file), "%s/%s", cache->dirs[i], name);
+		struct stat st;
+		if( 0 == stat(file, &st) && S_ISREG(st.st_mode) && 0 == access(file, X_OK) ){
+			return strdup(file);
+		}
+	}
+	return NULL;
+}
+
+/*
+ Returns file to execute for command <name>, or NULL if not found.
+*/
+const char * _path_resolve(const char * name, const char * path, const char * cwd){
+	PathCache * cache = _path_cache(path, _path_relative(path) ? cwd : NULL);
+	_path_check(cache);
+	Resolved ** bucket = cache->names + (_hash_string(name) & (PATH_CACHE - 1));
+	Resolved * r = *bucket;
+	while( r && strcmp(r->name, name) ) r = r->next;
+	if( !r ){
+		if( cache->resolvedCount == MAX_RESOLVED ) _path_clear(cache);
+		cache->resolvedCount += 1;
+		r = malloc(sizeof(Resolved) + strlen(name) + 1);
+		strcpy(r->name, name);
+		r->file = _path_search(cache, name);
+		r->next = *bucket;
+		*bucket = r;
+	}
+	return r->file;
+}
+
+/*
+ Environment of job is gopard's own, without PWD, with env= overrides of
+ job applied.
+ Returned array only is allocated, strings are shared.
+*/
+static char ** _env_build(Job * job){
+	int count = 0;
+	while( environ[count] ) count += 1;
+	char ** envp = malloc(sizeof(char*) * (count + job->envCount + 1));
+	int n = 0;
+	for (char ** var = environ; *var; ++var) {
+		bool overridden = false;
+		for (int i = 0; i < job->envCount && !overridden; ++i) {
+			overridden = _env_sameName(*var, job->env[i]);
+		}
+		if( !overridden && !_env_sameName(*var, "PWD") ) envp[n++] = *var;
+	}
+	for (int i = 0; i < job->envCount; ++i) {
+		if( strchr(job->env[i], '=') ) envp[n++] = job->env[i];
+	}
+	envp[n] = NULL;
+	return envp;
+}
+
+void _plan_environment(SpawnPlan * plan, Job * job){
+	if( job->envCount || getenv("PWD") ) plan->envp = _env_build(job);
+	plan->cwd = job->cwd;
+	if( strchr(plan->argv[0], '/') ) return;
+	const char * path = NULL;
+	for (char ** var = plan->envp; *var && !path; ++var) {
+		if( 0 == strncmp(*var, "PATH=", 5) ) path = *var + 5;
+	}
+	const char * file = _path_resolve(plan->argv[0], path ? path : DEFAULT_PATH, job->cwd);
+	if( file ) plan->path = file;
+}
+
+pid_t _spawn_fork(SpawnPlan * plan){
+	pid_t pid = fork();
+	if( pid == 0 ){
+		_plan_exec(plan);
+	}
+	return pid;
+}
+
+#define SPAWN_STACK_SIZE 0x10000
+static char spawnStack[SPAWN_STACK_SIZE] __attribute__((aligned(16)));
+
+/*
+ Child shares parent memory and parent is suspended until child
+ execve or exits, so one static stack is enough and plan->err
+ is visible to parent.
+*/
+pid_t _spawn_vfork(SpawnPlan * plan){
+	return clone(&_plan_exec, spawnStack + SPAWN_STACK_SIZE,
+			CLONE_VM|CLONE_VFORK|SIGCHLD, plan);
+}
+
+typedef struct {
+	const char * name;
+	pid_t (*spawn)(SpawnPlan * plan);
+} SpawnEngine;
+
+static SpawnEngine spawnEngines[] = {
+		{ "vfork", &_spawn_vfork },
+		{ "fork", &_spawn_fork },
+		{ NULL, NULL },
+};
+static SpawnEngine * spawnEngine = spawnEngines;
+
+void _process_control_output(Buff* buff);
+bool _worker_attach(Run * run);
+bool _uring_attach(Run * run);
+void _run_openOutlets(Run * run);
+
+/*
+ Time index: stdout.idx/stderr.idx map CLOCK_MONOTONIC time of reads to
+ stream offset (and line number, when output passes through gopard),
+ at most one record every <index> milliseconds. Offsets are of the
+ uncompressed, unrotated stream, as in stdindex.csv.
+*/
+#define TIME_INDEX_VERSION 1
+#define NO_LINE UINT64_MAX
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	int64_t realtimeNs;
+	int64_t monotonicNs;
+} TimeIndexHeader;
+
+typedef struct {
+	uint64_t time;
+	uint64_t offset;
+	uint64_t line;
+} TimeIndexRecord;
+
+void _pipe_openTimeIndex(FilePipe * pipe, char * path, long ms){
+	pipe->timeIndex = fopen(path, "we");
+	if( !pipe->timeIndex ){
+		fprintf(stderr,"cannot open %s. errno:%s(%d)\n", path, strerror(errno), errno);
+		return;
+	}
+	TimeIndexHeader header = { "gpidx", TIME_INDEX_VERSION, sizeof(TimeIndexRecord),
+			_clock_ns(CLOCK_REALTIME), _clock_ns(CLOCK_MONOTONIC) };
+	fwrite(&header, sizeof(header), 1, pipe->timeIndex);
+	pipe->indexStep = (uint64_t)ms * 1000000;
+}
+
+/*
+ Called before <n> bytes at pipe->counter are stored; data is NULL when
+ bytes are spliced and never seen.
+*/
+void _pipe_timeIndex(FilePipe * pipe, const char * data, size_t n){
+	uint64_t now = _clock_ns(CLOCK_MONOTONIC);
+	if( now - pipe->indexLast >= pipe->indexStep ){
+		TimeIndexRecord r = { now, pipe->counter, data ? pipe->lines : NO_LINE };
+		fwrite(&r, sizeof(r), 1, pipe->timeIndex);
+		pipe->indexLast = now;
+	}
+	if( data ){
+		const char * end = data + n;
+		while( (data = memchr(data, '\n', end - data)) ){
+			++data;
+			++pipe->lines;
+		}
+	}
+}
+
+/*
+ Last record at or before <time>, or first record when there is none.
+*/
+long _timeIndex_search(const TimeIndexRecord * records, long count, uint64_t time){
+	long lo = 0, hi = count;
+	while( lo < hi ){
+		long mid = lo + (hi - lo) / 2;
+		if( records[mid].time <= time ){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+	return lo > 0 ? lo - 1 : 0;
+}
+
+/*
+ gopard --lookup=<stdout.idx> <time>: prints offset,line,time of output
+ at <time> given as "YYYY-MM-DD HH:MM:SS[.fraction]" local time or as
+ epoch seconds with fraction. line is -1 if unknown.
+*/
+int _timeIndex_lookup(const char * path, const char * when){
+	struct tm tm = {0};
+	double seconds;
+	char * rest = strptime(when, "%Y-%m-%d %H:%M:%S", &tm);
+	if( rest ){
+		tm.tm_isdst = -1;
+		seconds = mktime(&tm) + (*rest == '.' ? atof(rest) : 0);
+	}else{
+		seconds = atof(when);
+	}
+	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	struct stat st;
+	if( fd == -1 || fstat(fd, &st) == -1 ){
+		fprintf(stderr,"cannot open %s. errno:%s(%d)\n", path, strerror(errno), errno);
+		return EXIT_FAILURE;
+	}
+	char * map = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	TimeIndexHeader * header = (TimeIndexHeader *)map;
+	if( map == MAP_FAILED || st.st_size < sizeof(*header)
+			|| strcmp(header->magic, "gpidx") || header->recordSize != sizeof(TimeIndexRecord) ){
+		fprintf(stderr,"%s is not gopard time index\n", path);
+		return EXIT_FAILURE;
+	}
+	long count = (st.st_size - sizeof(*header)) / sizeof(TimeIndexRecord);
+	if( count == 0 ){
+		fprintf(stderr,"%s is empty\n", path);
+		return EXIT_FAILURE;
+	}
+	TimeIndexRecord * records = (TimeIndexRecord *)(map + sizeof(*header));
+	int64_t target = (int64_t)(seconds * 1e9) - header->realtimeNs + header->monotonicNs;
+	TimeIndexRecord * r = records + _timeIndex_search(records, count, target < 0 ? 0 : target);
+	int64_t real = r->time - header->monotonicNs + header->realtimeNs;
+	printf("%lu,%ld,%ld.%09ld\n", r->offset, r->line == NO_LINE ? -1 : (long)r->line,
+			real / 1000000000, real % 1000000000);
+	munmap(map, st.st_size);
+	return EXIT_SUCCESS;
+}
+
+static size_t _pipe_none(FilePipe * pipe){
+	return 0;
+}
+
+/*
+ Run which can't open its logs (usually out of descriptors) is killed and
+ finishes with reason error. Its pipes are closed, nothing is captured.
+*/
+static Run * _run_openFailed(Run * run, const char * path){
+	fprintf(stderr,"cannot open %s. errno:%s(%d)\n", path, strerror(errno), errno);
+	FilePipe * pipes[] = { &(run->std_out), &(run->std_err) };
+	for (int i = 0; i < 2; ++i) {
+		close(pipes[i]->in);
+		if( pipes[i]->out > -1 ) close(pipes[i]->out);
+		pipes[i]->in = pipes[i]->out = -1;
+		pipes[i]->capture = &_pipe_none;
+	}
+	if( run->index ) fclose(run->index);
+	run->index = NULL;
+	run->reason = "error";
+	run->terminating = true;
+	_run_signal(run, SIGKILL);
+	return run;
+}
+
+Run* _run_open(Run* run, int inputStdOut, int inputStdErr){
+	run->std_out.in = inputStdOut;
+	run->std_err.in = inputStdErr;
+	_run_mkdir(run);
+//	printf("open err=%d, out=%d\n", run->std_err.in, run->std_out.in );
+	long frame = run->job ? (run->job->compress >= 0 ? run->job->compress : compressFrame) : 0;
+#ifdef NO_ZLIB
+	frame = 0;
+#endif
+	bool gz = frame > 0;
+	run->std_out.out = open(_run_path(run, DEFAULT, gz ? OUT_GZ_FILE : OUT_FILE), O_WRONLY|O_CREAT|O_CLOEXEC , 0644);
+	if( run->std_out.out == -1 ) return _run_openFailed(run, buff);
+	run->std_err.out = open(_run_path(run, DEFAULT, gz ? ERR_GZ_FILE : ERR_FILE), O_WRONLY|O_CREAT|O_CLOEXEC , 0644);
+	if( run->std_err.out == -1 ) return _run_openFailed(run, buff);
+	run->index = fopen(_run_path(run, DEFAULT, INDEX_FILE), "we");
+	if( !run->index ) return _run_openFailed(run, buff);
+	fprintf(run->index, gz ? "stream,time,size,zoffset\n" : "stream,time,size\n");
+	if( gz ){
+		run->std_out.frameSize = run->std_err.frameSize = frame;
+		run->std_out.capture = run->std_err.capture = &_pipe_copy;
+	}
+	run->std_out.pathType = gz ? OUT_GZ_FILE : OUT_FILE;
+	run->std_err.pathType = gz ? ERR_GZ_FILE : ERR_FILE;
+	if( run->job ){
+		Job * job = run->job;
+		size_t limit = job->maxOutput >= 0 ? job->maxOutput : maxOutput;
+		size_t rotate = job->rotate >= 0 ? job->rotate : rotateOutput;
+		size_t ring = job->ring >= 0 ? job->ring : ringOutput;
+		if( ring && !rotate ) rotate = ring / 2 > 4096 ? ring / 2 : 4096;
+		run->std_out.limit = run->std_err.limit = limit;
+		run->std_out.rotate = run->std_err.rotate = rotate;
+		run->std_out.ring = run->std_err.ring = ring;
+		long ms = job->index >= 0 ? job->index : indexMillis;
+		if( ms > 0 ){
+			_pipe_openTimeIndex(&(run->std_out), _run_path(run, DEFAULT, OUT_TIME_INDEX_FILE), ms);
+			_pipe_openTimeIndex(&(run->std_err), _run_path(run, DEFAULT, ERR_TIME_INDEX_FILE), ms);
+		}
+	}
+	if(run->runType == CONTROL){
+		run->std_out.buff = &controlBuffer;
+		run->std_out.callback = &_process_control_output;
+		run->std_out.capture = &_pipe_copy;
+	}else if( pipeSize > 0 ){
+		fcntl(inputStdOut, F_SETPIPE_SZ, pipeSize);
+		fcntl(inputStdErr, F_SETPIPE_SZ, pipeSize);
+	}
+	if( run->job ) _run_openOutlets(run);
+	if( _uring_attach(run) ) return run;
+	_fd_setNonBlocking(inputStdOut);
+	_fd_setNonBlocking(inputStdErr);
+	if( !_worker_attach(run) ){
+		_watch_add(&(run->std_out.watch), inputStdOut, EPOLLIN);
+		_watch_add(&(run->std_err.watch), inputStdErr, EPOLLIN);
+	}
+	return run;
+}
+
+static bool binaryControl = false;
+
+#define MAX_CONTROL_OUT 0x400000 // 4M
+#define FRAME_EVENT 'e'
+static Buff controlOut;
+static Watch controlInWatch;
+static unsigned long droppedEvents = 0;
+
+static void _put_be32(char * p, uint32_t v){
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+void _control_flush(){
+	while( controlOut.used > 0 ){
+		if( controlInWatch.fd == -1 ){
+			_buff_reset(&controlOut);
+			break;
+		}
+		ssize_t n = write(controlInWatch.fd, controlOut.head, controlOut.used);
+		if( n < 0 ){
+			if( errno == EINTR ) continue;
+			if( errno == EAGAIN ) break;
+			/* control closed its standard input */
+			_watch_close(&controlInWatch);
+			continue;
+		}
+		_buff_consume(&controlOut, n);
+	}
+}
+
+void _controlIn_onEvent(void * owner, uint32_t events){
+	_control_flush();
+}
+
+static bool _control_append(const char * name, int count, const char ** fields){
+	int need = strlen(name) + 1;
+	for (int i = 0; i < count; ++i) {
+		need += strlen(fields[i]) + 1;
+	}
+	if( binaryControl ) need += 9 + 4 * (count + 1);
+	while( _buff_left(&controlOut) < need ){
+		if( !_buff_grow(&controlOut, MAX_CONTROL_OUT) ) return false;
+	}
+	char * p = _buff_tail(&controlOut);
+	if( binaryControl ){
+		_put_be32(p, need - 4);
+		p[4] = FRAME_EVENT;
+		_put_be32(p + 5, count + 1);
+		p += 9;
+		for (int i = -1; i < count; ++i) {
+			const char * f = i < 0 ? name : fields[i];
+			uint32_t len = strlen(f) + 1;
+			_put_be32(p, len);
+			memcpy(p + 4, f, len);
+			p += 4 + len;
+		}
+	}else{
+		p = stpcpy(p, name);
+		for (int i = 0; i < count; ++i) {
+			*p++ = i ? ',' : ':';
+			p = stpcpy(p, fields[i]);
+		}
+		*p++ = '\n';
+	}
+	controlOut.used += need;
+	return true;
+}
+
+void _control_event(const char * name, int count, const char ** fields){
+	if( controlInWatch.fd == -1 ) return;
+	if( droppedEvents ){
+		char dropped[24];
+		const char * f[] = { dropped };
+		snprintf(dropped, sizeof(dropped), "%lu", droppedEvents);
+		if( !_control_append("dropped", 1, f) ){
+			droppedEvents += 1;
+			return;
+		}
+		droppedEvents = 0;
+	}
+	if( !_control_append(name, count, fields) ){
+		droppedEvents += 1;
+	}
+}
+
+void _run_indexRow(Run * run, FilePipe * pipe, const char * suffix, time_t tt, size_t size, size_t zoffset){
+	if( !run->index ) return;
+	char stamp[TIMESTAMP_SIZE];
+	fprintf(run->index, "%s%s,%s,%ld", pipe->name, suffix, _timestamp(tt, stamp), size);
+	if( pipe->frameSize ){
+		fprintf(run->index, ",%ld\n", zoffset);
+	}else{
+		fputc('\n', run->index);
+	}
+}
+
+void _run_outputEvent(Run * run, FilePipe * pipe, size_t size){
+	char value[24];
+	snprintf(value, sizeof(value), "%ld", size);
+	const char * f[] = { run->job->name, run->id, pipe->name, value };
+	_control_event("output", 4, f);
+}
+
+static __thread struct Worker * currentWorker = NULL;
+void _worker_output(FilePipe * pipe, size_t size);
+void _worker_counters(Run * run);
+
+void _run_storePipeEvent(Run * run, FilePipe * pipe) {
+	if (!pipe->event.stored) {
+		_run_indexRow(run, pipe, "", pipe->event.time, pipe->event.size, pipe->event.zoffset);
+		pipe->event.stored = true;
+		/* initial row of empty stream is not news to control */
+		if( run->job && pipe->event.size > 0 ){
+			if( currentWorker ){
+				_worker_output(pipe, pipe->event.size);
+			}else{
+				_run_outputEvent(run, pipe, pipe->event.size);
+			}
+		}
+	}
+}
+
+void _run_progress(Run * run){
+	if( currentWorker ){
+		_worker_counters(run);
+	}else{
+		_status_counters(run);
+	}
+}
+
+/*
+ Single producer single consumer ring: producer calls Queue_put, one
+ other thread calls Queue_take.
+*/
+#define SPSC_QUEUE(Queue, Message, SIZE) \
+typedef struct { \
+	Message ring[SIZE]; \
+	_Atomic size_t head; \
+	_Atomic size_t tail; \
+} Queue; \
+static bool Queue##_put(Queue * q, Message * m){ \
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed); \
+	if( head - atomic_load_explicit(&q->tail, memory_order_acquire) == SIZE ) return false; \
+	q->ring[head % SIZE] = *m; \
+	atomic_store_explicit(&q->head, head + 1, memory_order_release); \
+	return true; \
+} \
+static bool Queue##_take(Queue * q, Message * m){ \
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed); \
+	if( tail == atomic_load_explicit(&q->head, memory_order_acquire) ) return false; \
+	*m = q->ring[tail % SIZE]; \
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release); \
+	return true; \
+}
+
+static void _eventfd_signal(int fd){
+	uint64_t one = 1;
+	write(fd, &one, sizeof(one));
+}
+
+static void _eventfd_drain(int fd){
+	uint64_t count;
+	while( read(fd, &count, sizeof(count)) == sizeof(count) );
+}
+
+/*
+ Log writer (--write-buffer=<bytes>): log output of job pipe is
+ collected in chunks of <bytes>, handed to writer thread when full,
+ older than --flush-ms, and at rotation and finish. Writer coalesces
+ consecutive chunks of a file into one pwritev. Pipe having more than
+ OUTLET_HIGH chunks not yet written is not read until writer is down to
+ OUTLET_LOW, so slow disk holds back only jobs writing to it, and loop
+ never waits on disk. Chunk that does not fit queue of its thread waits
+ in backlog of the thread, its pipe not read, until writer made room.
+ Outlet is log file descriptor as writer sees it;
+ writer closes it (after fdatasync with sync=1) and frees it.
+*/
+#define WRITER_QUEUE 4096
+#define WRITER_IOV 64
+#define OUTLET_HIGH 8
+#define OUTLET_LOW 2
+
+typedef enum {
+	OUTLET_READING,
+	OUTLET_PAUSED,
+	OUTLET_RESUMING,
+	OUTLET_FINAL,
+} OutletState;
+
+typedef struct Outlet {
+	int fd;
+	bool sync;
+	size_t offset;
+	_Atomic int queued;
+	_Atomic int state;
+	Watch * watch;
+	struct Outlet * closeNext;
+} Outlet;
+
+typedef struct {
+	Outlet * outlet;
+	char * data;
+	size_t size;
+	size_t offset;
+} WriteMessage;
+
+typedef struct WriteBacklog {
+	struct WriteBacklog * next;
+	WriteMessage m;
+} WriteBacklog;
+
+SPSC_QUEUE(WriterQueue, WriteMessage, WRITER_QUEUE)
+
+static size_t writeBuffer = 0;
+static long flushMillis = 1000;
+static bool syncLogs = false;
+static pthread_t writerThread;
+static int writerWake = -1;
+static _Atomic bool writerQuit = false;
+static WriterQueue * writerQueues = NULL;
+static int writerQueueCount = 0;
+static int * writerRooms = NULL;
+static _Atomic bool * writerFull = NULL;
+static __thread WriterQueue * writerQueue = NULL;
+static __thread WriteBacklog * backlogHead = NULL;
+static __thread WriteBacklog * backlogTail = NULL;
+static __thread FilePipe * dirtyHead = NULL;
+static Watch flushWatch;
+static Watch roomWatch;
+
+static uint64_t _clock_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void _outlet_resume(Outlet * outlet){
+	int paused = OUTLET_PAUSED;
+	if( atomic_compare_exchange_strong(&outlet->state, &paused, OUTLET_RESUMING) ){
+		/* epoll_ctl MOD reports pipe again if it has data */
+		struct epoll_event ev = { EPOLLIN | EPOLLET, { .ptr = outlet->watch } };
+		epoll_ctl(outlet->watch->epoll, EPOLL_CTL_MOD, outlet->watch->fd, &ev);
+		atomic_store(&outlet->state, OUTLET_READING);
+	}
+}
+
+/*
+ <backlogged> outlet is resumed by writer once it wrote chunk in backlog.
+*/
+static void _outlet_pause(Outlet * outlet, bool backlogged){
+	struct epoll_event ev = { 0, { .ptr = outlet->watch } };
+	epoll_ctl(outlet->watch->epoll, EPOLL_CTL_MOD, outlet->watch->fd, &ev);
+	int reading = OUTLET_READING;
+	atomic_compare_exchange_strong(&outlet->state, &reading, OUTLET_PAUSED);
+	/* writer could catch up before it saw pause */
+	if( !backlogged && atomic_load(&outlet->queued) <= OUTLET_LOW ) _outlet_resume(outlet);
+}
+
+/*
+ Moves backlog of calling thread to its queue, as far as it fits.
+ Returns true if backlog is empty.
+*/
+static bool _writer_putBacklog(){
+	while( backlogHead ){
+		WriteBacklog * b = backlogHead;
+		if( !WriterQueue_put(writerQueue, &(b->m)) ){
+			atomic_store(writerFull + (writerQueue - writerQueues), true);
+			/* writer could make room before it saw flag */
+			atomic_thread_fence(memory_order_seq_cst);
+			if( !WriterQueue_put(writerQueue, &(b->m)) ){
+				_eventfd_signal(writerWake);
+				return false;
+			}
+		}
+		backlogHead = b->next;
+		if( !backlogHead ) backlogTail = NULL;
+		free(b);
+	}
+	return true;
+}
+
+static void _writer_put(WriteMessage * m){
+	if( backlogHead || !WriterQueue_put(writerQueue, m) ){
+		WriteBacklog * b = malloc(sizeof(WriteBacklog));
+		b->next = NULL;
+		b->m = *m;
+		if( backlogTail ) backlogTail->next = b; else backlogHead = b;
+		backlogTail = b;
+		if( m->data && atomic_load(&m->outlet->state) == OUTLET_READING ){
+			_outlet_pause(m->outlet, true);
+		}
+		_writer_putBacklog();
+	}
+	_eventfd_signal(writerWake);
+}
+
+void _room_onEvent(void * owner, uint32_t events){
+	Watch * watch = owner;
+	_eventfd_drain(watch->fd);
+	_writer_putBacklog();
+	_eventfd_signal(writerWake);
+}
+
+/*
+ Adds watch of room made by writer in queue <producer> to <epoll>.
+*/
+void _writer_room(int epoll, Watch * watch, int producer){
+	_watch_init(watch, &_room_onEvent, watch);
+	if( writeBuffer == 0 ) return;
+	_watch_addTo(epoll, watch, writerRooms[producer], EPOLLIN);
+}
+
+/*
+ At thread exit, when loop does not run any more.
+*/
+static void _writer_flushBacklog(){
+	while( !_writer_putBacklog() ) sched_yield();
+}
+
+/*
+ After this pipe is never paused and writer does not touch its watch.
+ Returns true if pipe was left paused, its watch disarmed.
+*/
+static bool _outlet_final(Outlet * outlet){
+	for(;;){
+		int state = atomic_load(&outlet->state);
+		if( state == OUTLET_FINAL ) return false;
+		if( state != OUTLET_RESUMING && atomic_compare_exchange_strong(&outlet->state, &state, OUTLET_FINAL) ){
+			return state == OUTLET_PAUSED;
+		}
+		sched_yield();
+	}
+}
+
+#define _pipe_paused(p) ((p)->outlet && atomic_load(&(p)->outlet->state) == OUTLET_PAUSED)
+
+static void _pipe_dirtyUnlink(FilePipe * pipe){
+	if( !pipe->dirty ) return;
+	if( pipe->dirtyPrev ) pipe->dirtyPrev->dirtyNext = pipe->dirtyNext; else dirtyHead = pipe->dirtyNext;
+	if( pipe->dirtyNext ) pipe->dirtyNext->dirtyPrev = pipe->dirtyPrev;
+	pipe->dirtyPrev = pipe->dirtyNext = NULL;
+	pipe->dirty = false;
+}
+
+void _pipe_handOff(FilePipe * pipe){
+	_pipe_dirtyUnlink(pipe);
+	if( !pipe->chunkUsed ) return;
+	Outlet * outlet = pipe->outlet;
+	WriteMessage m = { outlet, pipe->chunk, pipe->chunkUsed, outlet->offset };
+	outlet->offset += pipe->chunkUsed;
+	pipe->chunk = NULL;
+	pipe->chunkUsed = 0;
+	if( atomic_fetch_add(&outlet->queued, 1) + 1 > OUTLET_HIGH && atomic_load(&outlet->state) == OUTLET_READING ){
+		_outlet_pause(outlet, false);
+	}
+	_writer_put(&m);
+}
+
+void _pipe_output(FilePipe * pipe, const char * data, size_t n){
+	if( !pipe->outlet ){
+		write(pipe->out, data, n);
+		return;
+	}
+	while( n > 0 ){
+		if( !pipe->chunk ){
+			pipe->chunk = malloc(writeBuffer);
+			pipe->chunkTime = _clock_ms();
+			pipe->dirtyPrev = NULL;
+			pipe->dirtyNext = dirtyHead;
+			if( dirtyHead ) dirtyHead->dirtyPrev = pipe;
+			dirtyHead = pipe;
+			pipe->dirty = true;
+		}
+		size_t k = writeBuffer - pipe->chunkUsed;
+		if( k > n ) k = n;
+		memcpy(pipe->chunk + pipe->chunkUsed, data, k);
+		pipe->chunkUsed += k;
+		data += k;
+		n -= k;
+		if( pipe->chunkUsed == writeBuffer ) _pipe_handOff(pipe);
+	}
+}
+
+void _pipe_openOutlet(FilePipe * pipe){
+	Outlet * outlet = malloc(sizeof(Outlet));
+	outlet->fd = pipe->out;
+	outlet->sync = pipe->sync;
+	outlet->offset = 0;
+	atomic_init(&outlet->queued, 0);
+	atomic_init(&outlet->state, OUTLET_READING);
+	outlet->watch = &(pipe->watch);
+	pipe->outlet = outlet;
+}
+
+/*
+ Pipe stops being paused for good, before its last drain.
+*/
+void _pipe_finalOutlet(FilePipe * pipe){
+	if( pipe->outlet ) _outlet_final(pipe->outlet);
+}
+
+/*
+ Returns false if pipe writes itself and has to close log. <paused> tells
+ whether watch of pipe was left disarmed.
+*/
+bool _pipe_closeOutlet(FilePipe * pipe, bool * paused){
+	Outlet * outlet = pipe->outlet;
+	if( !outlet ) return false;
+	_pipe_handOff(pipe);
+	bool wasPaused = _outlet_final(outlet);
+	if( paused ) *paused = wasPaused;
+	WriteMessage m = { outlet, NULL, 0, 0 };
+	_writer_put(&m);
+	pipe->outlet = NULL;
+	return true;
+}
+
+void _flush_onTimer(void * owner, uint32_t events){
+	Watch * watch = owner;
+	_eventfd_drain(watch->fd);
+	uint64_t old = _clock_ms() - flushMillis;
+	FilePipe * next;
+	for (FilePipe * pipe = dirtyHead; pipe; pipe = next) {
+		next = pipe->dirtyNext;
+		if( pipe->chunkTime <= old ) _pipe_handOff(pipe);
+	}
+}
+
+/*
+ Adds timer flushing aged chunks of calling thread to <epoll>.
+*/
+void _flush_timer(int epoll, Watch * watch){
+	_watch_init(watch, &_flush_onTimer, watch);
+	if( writeBuffer == 0 ) return;
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	long ms = flushMillis > 0 ? flushMillis : 1;
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = ms / 1000;
+	spec.it_interval.tv_nsec = (ms % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+	if( fd == -1 || -1 == timerfd_settime(fd, 0, &spec, NULL) || -1 == _watch_addTo(epoll, watch, fd, EPOLLIN) ){
+		fprintf(stderr,"flush timer failed. errno:%s(%d) \n", strerror(errno),errno);
+		if( fd > -1 ) close(fd);
+	}
+}
+
+static void _writer_write(Outlet * outlet, struct iovec * iov, int count, size_t offset){
+	int i = 0;
+	while( i < count ){
+		ssize_t n = pwritev(outlet->fd, iov + i, count - i, offset);
+		if( n < 0 ){
+			if( errno == EINTR ) continue;
+			fprintf(stderr, "writer: write failed: errno=%s(%d)\n", strerror(errno),errno);
+			break;
+		}
+		offset += n;
+		while( i < count && (size_t)n >= iov[i].iov_len ){
+			n -= iov[i++].iov_len;
+		}
+		if( i < count ){
+			iov[i].iov_base = (char *)iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+		}
+	}
+}
+
+static void _writer_done(Outlet * outlet, struct iovec * iov, char ** chunks, int count){
+	for (int i = 0; i < count; ++i) {
+		free(chunks[i]);
+	}
+	if( atomic_fetch_sub(&outlet->queued, count) - count <= OUTLET_LOW ){
+		_outlet_resume(outlet);
+	}
+}
+
+/*
+ Chunks of one outlet can come from two queues (worker and then
+ coordinator), so close waits until none of them is left.
+*/
+static Outlet * closing = NULL;
+
+static void _writer_close(){
+	Outlet ** p = &closing;
+	while( *p ){
+		Outlet * outlet = *p;
+		if( atomic_load(&outlet->queued) > 0 ){
+			p = &(outlet->closeNext);
+			continue;
+		}
+		*p = outlet->closeNext;
+		if( outlet->sync ) fdatasync(outlet->fd);
+		close(outlet->fd);
+		free(outlet);
+	}
+}
+
+static bool _writer_drain(){
+	struct iovec iov[WRITER_IOV];
+	char * chunks[WRITER_IOV];
+	bool any = false;
+	for (int q = 0; q < writerQueueCount; ++q) {
+		WriteMessage m;
+		Outlet * outlet = NULL;
+		size_t start = 0, end = 0;
+		int count = 0;
+		while( WriterQueue_take(writerQueues + q, &m) ){
+			any = true;
+			if( count && (!m.data || m.outlet != outlet || m.offset != end || count == WRITER_IOV) ){
+				_writer_write(outlet, iov, count, start);
+				_writer_done(outlet, iov, chunks, count);
+				count = 0;
+			}
+			if( !m.data ){
+				m.outlet->closeNext = closing;
+				closing = m.outlet;
+				continue;
+			}
+			if( count == 0 ){
+				outlet = m.outlet;
+				start = end = m.offset;
+			}
+			iov[count].iov_base = m.data;
+			iov[count].iov_len = m.size;
+			chunks[count++] = m.data;
+			end += m.size;
+		}
+		if( count ){
+			_writer_write(outlet, iov, count, start);
+			_writer_done(outlet, iov, chunks, count);
+		}
+		atomic_thread_fence(memory_order_seq_cst);
+		if( atomic_exchange(writerFull + q, false) ) _eventfd_signal(writerRooms[q]);
+	}
+	_writer_close();
+	return any;
+}
+
+static void * _writer_main(void * arg){
+	for(;;){
+		uint64_t count;
+		read(writerWake, &count, sizeof(count));
+		while( _writer_drain() );
+		if( atomic_load(&writerQuit) ){
+			while( _writer_drain() );
+			return NULL;
+		}
+	}
+}
+
+/*
+ Writer takes from <producers> queues, one per thread producing output.
+*/
+void _writer_init(int producers){
+	if( writeBuffer == 0 ) return;
+	writerQueueCount = producers;
+	writerQueues = calloc(producers, sizeof(WriterQueue));
+	writerQueue = writerQueues;
+	writerRooms = malloc(sizeof(int) * producers);
+	writerFull = calloc(producers, sizeof(_Atomic bool));
+	for (int i = 0; i < producers; ++i) {
+		writerRooms[i] = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	}
+	writerWake = eventfd(0, EFD_CLOEXEC);
+	int err = pthread_create(&writerThread, NULL, &_writer_main, NULL);
+	if( err ){
+		fprintf(stderr,"writer thread failed. errno:%s(%d) \n", strerror(err),err);
+		exit(1);
+	}
+}
+
+void _writer_stop(){
+	if( writeBuffer == 0 ) return;
+	_writer_flushBacklog();
+	atomic_store(&writerQuit, true);
+	_eventfd_signal(writerWake);
+	pthread_join(writerThread, NULL);
+	close(writerWake);
+	for (int i = 0; i < writerQueueCount; ++i) {
+		close(writerRooms[i]);
+	}
+	free(writerRooms);
+	free(writerFull);
+	free(writerQueues);
+}
+
+/*
+ Compressed logs are concatenation of gzip members (frames), each
+ decodable on its own. Frame is cut when it reaches frameSize and at
+ every checkpoint, so each stdindex.csv row gives uncompressed size and
+ compressed zoffset where reading can start.
+*/
+#ifndef NO_ZLIB
+static __thread char zbuffer[0x10000];
+
+static void _pipe_deflate(FilePipe * pipe, const char * data, size_t n, int flush){
+	z_stream * z = pipe->z;
+	z->next_in = (Bytef*)data;
+	z->avail_in = n;
+	do{
+		z->next_out = (Bytef*)zbuffer;
+		z->avail_out = sizeof(zbuffer);
+		deflate(z, flush);
+		size_t have = sizeof(zbuffer) - z->avail_out;
+		if( have ){
+			_pipe_output(pipe, zbuffer, have);
+			pipe->zcounter += have;
+		}
+	}while( z->avail_out == 0 );
+}
+#endif
+
+void _pipe_endFrame(FilePipe * pipe){
+#ifndef NO_ZLIB
+	if( pipe->z && pipe->frameIn > 0 ){
+		_pipe_deflate(pipe, NULL, 0, Z_FINISH);
+		deflateReset(pipe->z);
+	}
+#endif
+	pipe->frameIn = 0;
+}
+
+void _pipe_newFrame(FilePipe * pipe){
+	_run_storePipeEvent(pipe->run, pipe);
+	_pipe_endFrame(pipe);
+	_event_set(&(pipe->event), pipe->counter);
+	pipe->event.zoffset = pipe->zcounter;
+	_run_storePipeEvent(pipe->run, pipe);
+}
+
+void _uring_write(FilePipe * pipe, const char * data, size_t n);
+
+void _pipe_sink(FilePipe * pipe, const char * data, size_t n){
+	pipe->frameIn += n;
+#ifndef NO_ZLIB
+	if( pipe->frameSize ){
+		if( !pipe->z ){
+			pipe->z = calloc(1, sizeof(z_stream));
+			deflateInit2(pipe->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+		}
+		_pipe_deflate(pipe, data, n, Z_NO_FLUSH);
+		return;
+	}
+#endif
+	if( pipe->uringBuffer > -1 ){
+		_uring_write(pipe, data, n);
+	}else{
+		_pipe_output(pipe, data, n);
+	}
+	pipe->written += n;
+}
+
+/*
+ Log of stream is split in segments: stdout.log, then stdout.log.1,
+ stdout.log.2 ... every <rotate> bytes of stream. In ring mode first
+ segment is kept and only last <ring> bytes of segments after it.
+ Segment starts, deleted segments and point where stream stopped being
+ logged because of <limit> are rows in stdindex.csv: out.<n>,
+ out.<n>.deleted and out.truncated.
+*/
+#define _pipe_capped(p, offset) ((p)->limit && (offset) >= (p)->limit)
+
+static size_t _pipe_room(FilePipe * pipe, size_t offset){
+	size_t room = (size_t)-1;
+	if( pipe->limit ) room = offset < pipe->limit ? pipe->limit - offset : 0;
+	if( pipe->rotate && pipe->segmentStart + pipe->rotate - offset < room ){
+		room = pipe->segmentStart + pipe->rotate - offset;
+	}
+	return room;
+}
+
+static char * _pipe_segmentPath(FilePipe * pipe, int segment, char * path, size_t size){
+	Run * run = pipe->run;
+	int len = snprintf(path, size, "%s/%s/%s%s", statusRoot, runTypeNames[run->runType], run->id, pathSuffix[pipe->pathType]);
+	if( segment > 0 ){
+		snprintf(path + len, size - len, ".%d", segment);
+	}
+	return path;
+}
+
+void _pipe_rotate(FilePipe * pipe, size_t offset){
+	char suffix[32], path[PATH_MAX];
+	/* pending row describes segment being closed, it goes first */
+	_run_storePipeEvent(pipe->run, pipe);
+	_pipe_endFrame(pipe);
+	/* queued writes must reach kernel before their descriptor is closed */
+	_uring_submit();
+	bool paused = false;
+	bool buffered = _pipe_closeOutlet(pipe, &paused);
+	if( !buffered ) close(pipe->out);
+	pipe->written = 0;
+	pipe->segment += 1;
+	if( pipe->ring ){
+		int keep = pipe->ring / pipe->rotate;
+		int old = pipe->segment - (keep > 0 ? keep : 1);
+		if( old > 0 ){
+			unlink(_pipe_segmentPath(pipe, old, path, sizeof(path)));
+			pipe->dropped += pipe->rotate;
+			snprintf(suffix, sizeof(suffix), ".%d.deleted", old);
+			_run_indexRow(pipe->run, pipe, suffix, time(0), old * pipe->rotate, 0);
+		}
+	}
+	pipe->segmentStart = offset;
+	pipe->zcounter = 0;
+	pipe->out = open(_pipe_segmentPath(pipe, pipe->segment, path, sizeof(path)), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	snprintf(suffix, sizeof(suffix), ".%d", pipe->segment);
+	_run_indexRow(pipe->run, pipe, suffix, time(0), offset, 0);
+	if( buffered ) _pipe_openOutlet(pipe);
+	if( paused ){
+		/* new outlet reads, old one left pipe without events */
+		struct epoll_event ev = { EPOLLIN | EPOLLET, { .ptr = &(pipe->watch) } };
+		epoll_ctl(pipe->watch.epoll, EPOLL_CTL_MOD, pipe->watch.fd, &ev);
+	}
+}
+
+/*
+ Writes stream bytes starting at stream offset pipe->counter.
+*/
+void _pipe_write(FilePipe * pipe, const char * data, size_t n){
+	size_t offset = pipe->counter;
+	while( n > 0 ){
+		if( _pipe_capped(pipe, offset) ){
+			if( offset == pipe->limit ){
+				_run_storePipeEvent(pipe->run, pipe);
+				_run_indexRow(pipe->run, pipe, ".truncated", time(0), offset, pipe->zcounter);
+			}
+			pipe->dropped += n;
+			return;
+		}
+		size_t room = _pipe_room(pipe, offset);
+		if( room == 0 ){
+			_pipe_rotate(pipe, offset);
+			continue;
+		}
+		size_t k = n < room ? n : room;
+		_pipe_sink(pipe, data, k);
+		data += k;
+		n -= k;
+		offset += k;
+	}
+}
+
+/*
+ Last event of stream: its size and where compressed stream ends.
+*/
+void _pipe_finish(FilePipe * pipe){
+	_pipe_endFrame(pipe);
+#ifndef NO_ZLIB
+	if( pipe->z ){
+		deflateEnd(pipe->z);
+		free(pipe->z);
+		pipe->z = NULL;
+	}
+#endif
+	_event_set(&(pipe->event), pipe->counter);
+	pipe->event.zoffset = pipe->zcounter;
+}
+
+/*
+ Edge triggered: drain pipe until it would block.
+*/
+/*
+ Stores chunk of stream read from pipe.
+*/
+void _pipe_captured(FilePipe * pipe, const char * data, size_t cnt){
+	if( !pipe->frameSize ){
+		_event_set_iftime(&(pipe->event),pipe->counter);
+	}else if( _event_due(&(pipe->event),pipe->counter) || pipe->frameIn >= pipe->frameSize ){
+		/* checkpoint row is stored by new frame, with its zoffset */
+		_pipe_newFrame(pipe);
+	}
+	if( pipe->timeIndex ) _pipe_timeIndex(pipe, data, cnt);
+	_pipe_write(pipe,data,cnt);
+	pipe->counter += cnt;
+}
+
+size_t _pipe_copy(FilePipe * pipe){
+	size_t total = 0;
+	Buff * buff = pipe->buff;
+	pipe->empty = false;
+	while( _buff_left(buff) > 0 && !_pipe_paused(pipe) ){
+		char *tail = _buff_tail(buff);
+		ssize_t cnt = read(pipe->in,tail,_buff_left(buff));
+		if(cnt<0){
+			if( errno == EINTR ) continue;
+			if( errno != EAGAIN) {
+				fprintf(stderr, "copy: read failed: errno=%s(%d)\n", strerror(errno),errno);
+			}
+			pipe->empty = true;
+			break;
+		}
+		if(cnt == 0){
+			pipe->empty = true;
+			break;
+		}
+		_pipe_captured(pipe, tail, cnt);
+		total += cnt;
+		buff->used +=cnt;
+		if(pipe->callback) (*pipe->callback)(buff);
+	}
+	_run_storePipeEvent(pipe->run,pipe);
+	if( total ) _run_progress(pipe->run);
+	return total;
+}
+
+#define SPLICE_CHUNK 0x100000
+
+size_t _pipe_splice(FilePipe * pipe){
+	size_t total = 0;
+	for(;;){
+		size_t room = _pipe_room(pipe, pipe->counter);
+		if( room == 0 ){
+			if( _pipe_capped(pipe, pipe->counter) ){
+				/* rest of stream is read and dropped */
+				pipe->capture = &_pipe_copy;
+				return total + _pipe_copy(pipe);
+			}
+			_pipe_rotate(pipe, pipe->counter);
+			continue;
+		}
+		ssize_t cnt = splice(pipe->in, NULL, pipe->out, NULL, room < SPLICE_CHUNK ? room : SPLICE_CHUNK, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+		if(cnt<0){
+			if( errno == EINTR ) continue;
+			if( errno == EINVAL ){
+				/* log file system can't take spliced pages */
+				pipe->capture = &_pipe_copy;
+				return total + _pipe_copy(pipe);
+			}
+			if( errno != EAGAIN) {
+				fprintf(stderr, "splice: failed: errno=%s(%d)\n", strerror(errno),errno);
+			}
+			break;
+		}
+		if(cnt == 0) break;
+		_event_set_iftime(&(pipe->event),pipe->counter);
+		if( pipe->timeIndex ) _pipe_timeIndex(pipe, NULL, cnt);
+		pipe->counter += cnt;
+		total += cnt;
+	}
+	_run_storePipeEvent(pipe->run,pipe);
+	if( total ) _run_progress(pipe->run);
+	return total;
+}
+
+#define _pipe_capture(p) (*(p)->capture)(p)
+
+void _pipe_onEvent(void * owner, uint32_t events){
+	FilePipe * pipe = owner;
+	/* event of batch in which worker already detached pipe */
+	if( pipe->detached ) return;
+	_pipe_capture(pipe);
+}
+
+/*
+ With --workers=<n> job pipes are captured by <n> worker threads, each
+ with own epoll and buffer, while control, spawn and reap stay on main
+ (coordinator) thread. Coordinator attaches run to worker and detaches
+ it when process exited; between the two only worker touches run pipes
+ and stdindex.csv. Worker never writes status.map or control events,
+ it sends them back. Each direction is single producer single consumer
+ ring with eventfd to wake other side; release/acquire of ring indexes
+ hands run over with everything written to it before. Worker reports run
+ detached only after whole epoll batch was dispatched, as rest of batch
+ can still hold events of its pipes, which are skipped.
+*/
+#define WORKER_QUEUE 4096
+
+typedef enum {
+	WORKER_ATTACH,
+	WORKER_DETACH,
+	WORKER_QUIT,
+	WORKER_OUTPUT,
+	WORKER_COUNTERS,
+	WORKER_DETACHED,
+} WorkerMessageType;
+
+typedef struct {
+	WorkerMessageType type;
+	Run * run;
+	FilePipe * pipe;
+	size_t size;
+	size_t errSize;
+} WorkerMessage;
+
+SPSC_QUEUE(WorkerQueue, WorkerMessage, WORKER_QUEUE)
+
+typedef struct Worker {
+	pthread_t thread;
+	int epoll;
+	Watch wake;
+	Watch flushTimer;
+	Watch room;
+	WorkerQueue inbox;
+	WorkerQueue outbox;
+	bool posted;
+	Buff buff;
+	Run * detached;
+} Worker;
+
+static Worker * workers = NULL;
+static int workerCount = 0;
+static int nextWorker = 0;
+static Watch workersWatch;
+
+
+/* worker side */
+
+static void _worker_post(Worker * worker, WorkerMessage * m){
+	while( !WorkerQueue_put(&worker->outbox, m) ){
+		if( m->type == WORKER_COUNTERS ) return;
+		_eventfd_signal(workersWatch.fd);
+		sched_yield();
+	}
+	worker->posted = true;
+}
+
+void _worker_output(FilePipe * pipe, size_t size){
+	WorkerMessage m = { WORKER_OUTPUT, pipe->run, pipe, size, 0 };
+	_worker_post(currentWorker, &m);
+}
+
+void _worker_counters(Run * run){
+	WorkerMessage m = { WORKER_COUNTERS, run, NULL, run->std_out.counter, run->std_err.counter };
+	_worker_post(currentWorker, &m);
+}
+
+static bool _worker_receive(Worker * worker){
+	WorkerMessage m;
+	_eventfd_drain(worker->wake.fd);
+	while( WorkerQueue_take(&worker->inbox, &m) ){
+		Run * run = m.run;
+		switch( m.type ){
+		case WORKER_ATTACH:
+			run->std_out.buff = run->std_err.buff = &worker->buff;
+			_watch_addTo(worker->epoll, &(run->std_out.watch), run->std_out.in, EPOLLIN);
+			_watch_addTo(worker->epoll, &(run->std_err.watch), run->std_err.in, EPOLLIN);
+			break;
+		case WORKER_DETACH:
+			_pipe_finalOutlet(&(run->std_out));
+			_pipe_finalOutlet(&(run->std_err));
+			_pipe_capture(&(run->std_out));
+			_pipe_capture(&(run->std_err));
+			/* chunks left are on dirty list of this thread */
+			if( run->std_out.outlet ) _pipe_handOff(&(run->std_out));
+			if( run->std_err.outlet ) _pipe_handOff(&(run->std_err));
+			_watch_del(&(run->std_out.watch));
+			_watch_del(&(run->std_err.watch));
+			run->std_out.detached = run->std_err.detached = true;
+			/* coordinator drains rest with its own buffer */
+			run->std_out.buff = run->std_err.buff = &inputBuffer;
+			run->detachedNext = worker->detached;
+			worker->detached = run;
+			break;
+		case WORKER_QUIT:
+			_writer_flushBacklog();
+			return false;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+static void * _worker_main(void * arg){
+	Worker * worker = arg;
+	currentWorker = worker;
+	if( writerQueues ) writerQueue = writerQueues + 1 + (worker - workers);
+	struct epoll_event events[MAX_EVENTS];
+	for(;;){
+		int n = epoll_wait(worker->epoll, events, MAX_EVENTS, -1);
+		if (n < 0 && errno != EINTR){
+			perror("worker epoll_wait failed");
+		}
+		for (int i = 0; i < n; ++i) {
+			Watch * watch = events[i].data.ptr;
+			if( watch == &worker->wake ){
+				if( !_worker_receive(worker) ) return NULL;
+			}else{
+				(*watch->onEvent)(watch->owner, events[i].events);
+			}
+		}
+		while( worker->detached ){
+			Run * run = worker->detached;
+			worker->detached = run->detachedNext;
+			WorkerMessage m = { WORKER_DETACHED, run, NULL, 0, 0 };
+			_worker_post(worker, &m);
+		}
+		if( worker->posted ){
+			worker->posted = false;
+			_eventfd_signal(workersWatch.fd);
+		}
+	}
+}
+
+/* coordinator side */
+
+void _workers_receive(){
+	WorkerMessage m;
+	for (int i = 0; i < workerCount; ++i) {
+		while( WorkerQueue_take(&workers[i].outbox, &m) ){
+			switch( m.type ){
+			case WORKER_OUTPUT:
+				_run_outputEvent(m.run, m.pipe, m.size);
+				break;
+			case WORKER_COUNTERS:
+				_status_setCounters(m.run, m.size, m.errSize);
+				break;
+			case WORKER_DETACHED:
+				m.run->worker = NULL;
+				_run_finishing(m.run);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+void _workers_onEvent(void * owner, uint32_t events){
+	_eventfd_drain(workersWatch.fd);
+	_workers_receive();
+}
+
+static void _worker_send(Worker * worker, WorkerMessageType type, Run * run){
+	WorkerMessage m = { type, run, NULL, 0, 0 };
+	while( !WorkerQueue_put(&worker->inbox, &m) ){
+		/* worker may wait for room in its outbox meanwhile */
+		_workers_receive();
+		sched_yield();
+	}
+	_eventfd_signal(worker->wake.fd);
+}
+
+bool _worker_attach(Run * run){
+	if( workerCount == 0 || run->runType == CONTROL ) return false;
+	run->worker = workers + nextWorker;
+	nextWorker = (nextWorker + 1) % workerCount;
+	_worker_send(run->worker, WORKER_ATTACH, run);
+	return true;
+}
+
+void _worker_detach(Run * run){
+	_worker_send(run->worker, WORKER_DETACH, run);
+}
+
+void _workers_init(){
+	_watch_init(&workersWatch, &_workers_onEvent, NULL);
+	if( workerCount <= 0 ) return;
+	_watch_add(&workersWatch, eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC), EPOLLIN);
+	workers = calloc(workerCount, sizeof(Worker));
+	for (int i = 0; i < workerCount; ++i) {
+		Worker * worker = workers + i;
+		worker->epoll = epoll_create1(EPOLL_CLOEXEC);
+		_buff_allocate(&worker->buff, 0x8000);
+		_watch_init(&worker->wake, NULL, worker);
+		_watch_addTo(worker->epoll, &worker->wake, eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC), EPOLLIN);
+		_flush_timer(worker->epoll, &worker->flushTimer);
+		_writer_room(worker->epoll, &worker->room, 1 + i);
+		int err = pthread_create(&worker->thread, NULL, &_worker_main, worker);
+		if( err ){
+			fprintf(stderr,"worker thread failed. errno:%s(%d) \n", strerror(err),err);
+			exit(1);
+		}
+	}
+}
+
+void _workers_stop(){
+	for (int i = 0; i < workerCount; ++i) {
+		_worker_send(workers + i, WORKER_QUIT, NULL);
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].wake.fd);
+		_watch_close(&workers[i].flushTimer);
+		close(workers[i].epoll);
+		_buff_free(&workers[i].buff);
+	}
+	free(workers);
+	_watch_close(&workersWatch);
+}
+
+/*
+ With --io=uring job pipes are not in epoll: read is kept posted on each
+ of them in io_uring, into buffers kernel picks from provided pool, and
+ log writes are queued from same buffers (registered, when memlock limit
+ allows). Ring descriptor is in epoll, so loop makes one io_uring_enter
+ per iteration to submit everything queued and completions are read from
+ shared memory. Buffer goes back to pool when its writes complete. When
+ process exits posted reads are cancelled and rest is drained as usual;
+ run is finished only after its log writes completed too, so finished
+ events, finished.csv and sync=1 see whole logs.
+*/
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 128
+#define URING_BUFFER_SIZE 0x8000
+#define URING_GROUP 1
+#define URING_READ 1
+#define URING_WRITE 2
+#define URING_OTHER 3
+/* write completion carries pipe and buffer: pointers fit in 56 bits */
+#define URING_BID_SHIFT 56
+#define URING_PIPE_MASK ((1ul << URING_BID_SHIFT) - 8)
+
+typedef struct {
+	int fd;
+	unsigned * sqHead;
+	unsigned * sqTail;
+	unsigned sqMask;
+	unsigned sqEntries;
+	unsigned * sqArray;
+	struct io_uring_sqe * sqes;
+	unsigned * cqHead;
+	unsigned * cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe * cqes;
+	unsigned pending;
+	bool fixed;
+	char * pool;
+	int refs[URING_BUFFERS];
+	int writes;
+	FilePipe * starved;
+	FilePipe * starvedTail;
+	Watch watch;
+} Uring;
+
+static Uring uring = { .fd = -1 };
+static bool useUring = false;
+
+static int _uring_enter(unsigned submit, unsigned wait){
+	return syscall(SYS_io_uring_enter, uring.fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+void _uring_submit(){
+	while( uring.pending > 0 ){
+		int n = _uring_enter(uring.pending, 0);
+		if( n < 0 ){
+			if( errno == EINTR ) continue;
+			fprintf(stderr,"io_uring submit failed. errno:%s(%d) \n", strerror(errno),errno);
+			return;
+		}
+		uring.pending -= n;
+	}
+}
+
+static struct io_uring_sqe * _uring_sqe(uint8_t op, int fd, uint64_t userData){
+	unsigned tail = *uring.sqTail;
+	while( tail - atomic_load_explicit((_Atomic unsigned *)uring.sqHead, memory_order_acquire) >= uring.sqEntries ){
+		_uring_submit();
+	}
+	unsigned index = tail & uring.sqMask;
+	struct io_uring_sqe * sqe = uring.sqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->user_data = userData;
+	uring.sqArray[index] = index;
+	atomic_store_explicit((_Atomic unsigned *)uring.sqTail, tail + 1, memory_order_release);
+	uring.pending += 1;
+	return sqe;
+}
+
+static void _uring_provide(int bid){
+	struct io_uring_sqe * sqe = _uring_sqe(IORING_OP_PROVIDE_BUFFERS, 1, URING_OTHER);
+	sqe->addr = (uint64_t)(uring.pool + (size_t)bid * URING_BUFFER_SIZE);
+	sqe->len = URING_BUFFER_SIZE;
+	sqe->off = bid;
+	sqe->buf_group = URING_GROUP;
+}
+
+static void _uring_read(FilePipe * pipe){
+	struct io_uring_sqe * sqe = _uring_sqe(IORING_OP_READ, pipe->in, (uint64_t)pipe | URING_READ);
+	sqe->len = URING_BUFFER_SIZE;
+	sqe->off = -1;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_GROUP;
+	pipe->uringRead = true;
+}
+
+static void _uring_release(int bid){
+	if( --uring.refs[bid] > 0 ) return;
+	_uring_provide(bid);
+	FilePipe * pipe = uring.starved;
+	if( pipe ){
+		uring.starved = pipe->uringNext;
+		if( !uring.starved ) uring.starvedTail = NULL;
+		_uring_read(pipe);
+	}
+}
+
+void _uring_write(FilePipe * pipe, const char * data, size_t n){
+	int bid = pipe->uringBuffer;
+	struct io_uring_sqe * sqe = _uring_sqe(uring.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE,
+			pipe->out, ((uint64_t)bid << URING_BID_SHIFT) | (uint64_t)pipe | URING_WRITE);
+	sqe->addr = (uint64_t)data;
+	sqe->len = n;
+	sqe->off = pipe->written;
+	sqe->buf_index = 0;
+	uring.refs[bid] += 1;
+	pipe->uringWrites += 1;
+	uring.writes += 1;
+}
+
+bool _uring_attach(Run * run){
+	if( !useUring || run->runType == CONTROL ) return false;
+	run->uring = true;
+	_uring_read(&(run->std_out));
+	_uring_read(&(run->std_err));
+	return true;
+}
+
+static void _uring_checkDetached(Run * run){
+	if( !run->uring || !run->exited ) return;
+	FilePipe * pipes[] = { &(run->std_out), &(run->std_err) };
+	for (int i = 0; i < 2; ++i) {
+		if( pipes[i]->uringRead || pipes[i]->uringWrites ) return;
+	}
+	run->uring = false;
+	for (int i = 0; i < 2; ++i) {
+		_fd_setNonBlocking(pipes[i]->in);
+		pipes[i]->capture = &_pipe_copy;
+		/* ring writes at offsets, rest of stream is written at position */
+		if( !pipes[i]->frameSize ) lseek(pipes[i]->out, pipes[i]->written, SEEK_SET);
+	}
+	_run_finishing(run);
+}
+
+void _uring_detach(Run * run){
+	FilePipe * pipes[] = { &(run->std_out), &(run->std_err) };
+	for (int i = 0; i < 2; ++i) {
+		FilePipe * pipe = pipes[i];
+		if( !pipe->uringRead ) continue;
+		FilePipe * prev = NULL, * s = uring.starved;
+		for (; s && s != pipe; s = s->uringNext) prev = s;
+		if( s ){
+			/* no read posted while waiting for buffer */
+			if( prev ) prev->uringNext = s->uringNext; else uring.starved = s->uringNext;
+			if( uring.starvedTail == s ) uring.starvedTail = prev;
+			pipe->uringRead = false;
+			continue;
+		}
+		struct io_uring_sqe * sqe = _uring_sqe(IORING_OP_ASYNC_CANCEL, -1, URING_OTHER);
+		sqe->addr = (uint64_t)pipe | URING_READ;
+	}
+	_uring_checkDetached(run);
+}
+
+static void _uring_onRead(FilePipe * pipe, struct io_uring_cqe * cqe){
+	Run * run = pipe->run;
+	if( cqe->res > 0 ){
+		int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		pipe->uringBuffer = bid;
+		uring.refs[bid] = 1;
+		_pipe_captured(pipe, uring.pool + (size_t)bid * URING_BUFFER_SIZE, cqe->res);
+		pipe->uringBuffer = -1;
+		_uring_release(bid);
+		_run_storePipeEvent(run, pipe);
+		_status_counters(run);
+		if( !run->exited ){
+			_uring_read(pipe);
+			return;
+		}
+	}else if( cqe->res == -ENOBUFS && !run->exited ){
+		pipe->uringNext = NULL;
+		if( uring.starvedTail ) uring.starvedTail->uringNext = pipe; else uring.starved = pipe;
+		uring.starvedTail = pipe;
+		return;
+	}else if( cqe->res == -EINTR && !run->exited ){
+		_uring_read(pipe);
+		return;
+	}else if( cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -ENOBUFS ){
+		fprintf(stderr, "uring: read failed: errno=%s(%d)\n", strerror(-cqe->res), -cqe->res);
+	}
+	pipe->uringRead = false;
+	_uring_checkDetached(run);
+}
+
+/*
+ Handles all completions there are, without system call.
+*/
+bool _uring_complete(){
+	bool any = false;
+	unsigned head = *uring.cqHead;
+	for(;;){
+		unsigned tail = atomic_load_explicit((_Atomic unsigned *)uring.cqTail, memory_order_acquire);
+		if( head == tail ) break;
+		struct io_uring_cqe cqe = uring.cqes[head & uring.cqMask];
+		atomic_store_explicit((_Atomic unsigned *)uring.cqHead, ++head, memory_order_release);
+		any = true;
+		switch( cqe.user_data & 7 ){
+		case URING_READ:
+			_uring_onRead((FilePipe *)(cqe.user_data & ~7ul), &cqe);
+			break;
+		case URING_WRITE:{
+			FilePipe * pipe = (FilePipe *)(cqe.user_data & URING_PIPE_MASK);
+			if( cqe.res < 0 ){
+				fprintf(stderr, "uring: write failed: errno=%s(%d)\n", strerror(-cqe.res), -cqe.res);
+			}
+			_uring_release(cqe.user_data >> URING_BID_SHIFT);
+			pipe->uringWrites -= 1;
+			uring.writes -= 1;
+			_uring_checkDetached(pipe->run);
+			break;
+		}
+		}
+	}
+	return any;
+}
+
+void _uring_onEvent(void * owner, uint32_t events){
+	_uring_complete();
+}
+
+void _uring_flush(){
+	if( !useUring ) return;
+	do{
+		_uring_submit();
+	}while( _uring_complete() );
+}
+
+/*
+ Waits for all log writes, before gopard exits.
+*/
+void _uring_drain(){
+	if( !useUring ) return;
+	_uring_submit();
+	while( uring.writes > 0 ){
+		if( -1 == _uring_enter(0, 1) && errno != EINTR ){
+			fprintf(stderr,"io_uring wait failed. errno:%s(%d) \n", strerror(errno),errno);
+			return;
+		}
+		_uring_complete();
+	}
+}
+
+void _uring_init(){
+	if( !useUring ) return;
+	if( workerCount > 0 ){
+		fprintf(stderr,"io_uring is not used with --workers\n");
+		useUring = false;
+		return;
+	}
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	uring.fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &p);
+	if( uring.fd == -1 ){
+		fprintf(stderr,"io_uring is not available, using epoll. errno:%s(%d) \n", strerror(errno),errno);
+		useUring = false;
+		return;
+	}
+	size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if( p.features & IORING_FEAT_SINGLE_MMAP && cqSize > sqSize ) sqSize = cqSize;
+	char * sq = mmap(NULL, sqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+	char * cq = p.features & IORING_FEAT_SINGLE_MMAP ? sq
+			: mmap(NULL, cqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_CQ_RING);
+	uring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+	if( sq == MAP_FAILED || cq == MAP_FAILED || uring.sqes == MAP_FAILED ){
+		perror("io_uring mmap");
+		exit(1);
+	}
+	uring.sqHead = (unsigned *)(sq + p.sq_off.head);
+	uring.sqTail = (unsigned *)(sq + p.sq_off.tail);
+	uring.sqMask = *(unsigned *)(sq + p.sq_off.ring_mask);
+	uring.sqEntries = *(unsigned *)(sq + p.sq_off.ring_entries);
+	uring.sqArray = (unsigned *)(sq + p.sq_off.array);
+	uring.cqHead = (unsigned *)(cq + p.cq_off.head);
+	uring.cqTail = (unsigned *)(cq + p.cq_off.tail);
+	uring.cqMask = *(unsigned *)(cq + p.cq_off.ring_mask);
+	uring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	size_t poolSize = (size_t)URING_BUFFERS * URING_BUFFER_SIZE;
+	uring.pool = mmap(NULL, poolSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	struct iovec iov = { uring.pool, poolSize };
+	uring.fixed = 0 == syscall(SYS_io_uring_register, uring.fd, IORING_REGISTER_BUFFERS, &iov, 1);
+	struct io_uring_sqe * sqe = _uring_sqe(IORING_OP_PROVIDE_BUFFERS, URING_BUFFERS, URING_OTHER);
+	sqe->addr = (uint64_t)uring.pool;
+	sqe->len = URING_BUFFER_SIZE;
+	sqe->off = 0;
+	sqe->buf_group = URING_GROUP;
+	_uring_submit();
+	_watch_init(&uring.watch, &_uring_onEvent, NULL);
+	_watch_add(&uring.watch, uring.fd, EPOLLIN);
+}
+
+/*
+ Job logs go through writer unless io_uring writes them or they are
+ spliced.
+*/
+void _run_openOutlets(Run * run){
+	int sync = run->job->sync >= 0 ? run->job->sync : syncLogs;
+	run->std_out.sync = run->std_err.sync = sync;
+	if( writeBuffer > 0 && !useUring && run->std_out.capture == &_pipe_copy ){
+		_pipe_openOutlet(&(run->std_out));
+		_pipe_openOutlet(&(run->std_err));
+	}
+}
+
+
+void _journal_finished(Run * run);
+
+void _job_done(Run * run);
+
+void _run_free(Run* run){
+	if(run->control_in > -1) _watch_close(&controlInWatch);
+	_pipe_finish(&(run->std_out));
+	_pipe_finish(&(run->std_err));
+	_run_storePipeEvent(run,&(run->std_out));
+	_run_storePipeEvent(run,&(run->std_err));
+	_pipe_free(&(run->std_err));
+	_pipe_free(&(run->std_out));
+
+    //TODO move to separate method
+	//id,pid,runType,returnCode,startTime,endTime,duration,statusDirectory,outBytes,outDropped,outSegments,errBytes,errDropped,errSegments,userCpu,systemCpu,maxRssKb,minorFaults,majorFaults,voluntarySwitches,involuntarySwitches,blocksIn,blocksOut,startUs,endUs,durationUs,reason,job,attempt,cmd
+	char * finalPath ;
+	if(run->runType == CONTROL){
+		finalPath = _run_path(run,CONTROL,DIRECTORY);
+	}else{
+		char* moveFrom = strdup(_run_path(run,DEFAULT,DIRECTORY));
+		finalPath = _run_path(run,DONE,DIRECTORY);
+		mkdirs(finalPath,true);
+		if( -1 == rename(moveFrom,finalPath) ){
+			fprintf(stderr,"rename %s -> %s failed. errno:%s(%d) \n", moveFrom, finalPath, strerror(errno),errno);
+			finalPath = _run_path(run,DEFAULT,DIRECTORY);
+		}
+		free(moveFrom);
+	}
+	char start[TIMESTAMP_SIZE], end[TIMESTAMP_SIZE];
+	uint64_t duration = run->endMono - run->startMono;
+	fprintf(finished,"%s,%d,%s,%d,%s,%s,%lu,%s,%ld,%ld,%d,%ld,%ld,%d,%ld.%06ld,%ld.%06ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%lu,%lu,%lu,%s,%s,%d,%s\n",
+			run->id,
+			run->pid,
+			runTypeNames[run->runType],
+			run->returnCode,
+			_timestamp(run->start, start),
+			_timestamp(run->end, end),
+			duration / 1000000000,
+			finalPath,
+			run->std_out.counter,
+			run->std_out.dropped,
+			run->std_out.segment + 1,
+			run->std_err.counter,
+			run->std_err.dropped,
+			run->std_err.segment + 1,
+			run->usage.ru_utime.tv_sec, run->usage.ru_utime.tv_usec,
+			run->usage.ru_stime.tv_sec, run->usage.ru_stime.tv_usec,
+			run->usage.ru_maxrss,
+			run->usage.ru_minflt,
+			run->usage.ru_majflt,
+			run->usage.ru_nvcsw,
+			run->usage.ru_nivcsw,
+			run->usage.ru_inblock,
+			run->usage.ru_oublock,
+			run->startReal / 1000,
+			run->endReal / 1000,
+			duration / 1000,
+			run->reason,
+			run->job ? run->job->name : "",
+			run->job ? run->job->attempt : 0,
+			run->cmd
+	);
+	if( run->job ){
+		char pid[16], rc[16], start[24], end[24];
+		snprintf(pid, sizeof(pid), "%d", run->pid);
+		snprintf(rc, sizeof(rc), "%d", run->returnCode);
+		snprintf(start, sizeof(start), "%ld", run->start);
+		snprintf(end, sizeof(end), "%ld", run->end);
+		const char * f[] = { run->job->name, run->id, pid, rc, start, end, finalPath };
+		_control_event("finished", 7, f);
+	}
+
+	if(run->index) fclose(run->index);
+	if(run->usageLog) fclose(run->usageLog);
+	if(run->cgroup){
+		if( -1 == rmdir(run->cgroup) ){
+			fprintf(stderr,"rmdir %s failed. errno:%s(%d) \n", run->cgroup, strerror(errno),errno);
+		}
+		free(run->cgroup);
+	}
+	if(run == ctrlRun) ctrlRun = NULL;
+	_journal_finished(run);
+	_status_publish(run, STATUS_FREE);
+	_runs_remove(run);
+	if(run->runType != CONTROL) runningCount -= 1;
+	fdsInUse -= run->fds;
+	free(run->cmd);
+	free(run->id);
+	/* may start next job in this run slot */
+	if(run->job) _job_done(run);
+}
+
+/*
+ Optional sampler (--sample=<ms>): on timerfd tick appends a row of
+ /proc/<pid>/stat and /proc/<pid>/io numbers to usage.csv of every
+ running job, so memory and I/O can be watched before the job ends.
+*/
+static Watch sampleWatch;
+
+static ssize_t _proc_read(pid_t pid, const char * name, char * data, size_t size){
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/%s", pid, name);
+	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if( fd == -1 ) return -1;
+	ssize_t n = read(fd, data, size - 1);
+	close(fd);
+	data[n > 0 ? n : 0] = 0;
+	return n;
+}
+
+static unsigned long _proc_field(const char * data, const char * name){
+	const char * p = strstr(data, name);
+	return p ? strtoul(p + strlen(name), NULL, 10) : 0;
+}
+
+void _run_sample(Run * run, struct timespec * now){
+	static long tick = 0, page = 0;
+	if( !tick ){
+		tick = sysconf(_SC_CLK_TCK);
+		page = sysconf(_SC_PAGESIZE) / 1024;
+	}
+	char data[1024];
+	unsigned long minflt = 0, majflt = 0, utime = 0, stime = 0, vsize = 0;
+	long rss = 0;
+	if( _proc_read(run->pid, "stat", data, sizeof(data)) <= 0 ) return;
+	char * p = strrchr(data, ')');
+	if( !p || 6 != sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %lu %*u %lu %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %lu %ld",
+			&minflt, &majflt, &utime, &stime, &vsize, &rss) ){
+		return;
+	}
+	if( !run->usageLog ){
+		run->usageLog = fopen(_run_path(run, DEFAULT, USAGE_FILE), "we");
+		if( !run->usageLog ) return;
+		fprintf(run->usageLog, "time,userCpu,systemCpu,vsizeKb,rssKb,minorFaults,majorFaults,readChars,writeChars,readBytes,writeBytes\n");
+	}
+	fprintf(run->usageLog, "%ld.%03ld,%.2f,%.2f,%lu,%ld,%lu,%lu",
+			now->tv_sec, now->tv_nsec / 1000000,
+			(double)utime / tick, (double)stime / tick,
+			vsize / 1024, rss * page, minflt, majflt);
+	if( _proc_read(run->pid, "io", data, sizeof(data)) > 0 ){
+		fprintf(run->usageLog, ",%lu,%lu,%lu,%lu\n",
+				_proc_field(data, "rchar: "), _proc_field(data, "wchar: "),
+				_proc_field(data, "read_bytes: "), _proc_field(data, "write_bytes: "));
+	}else{
+		fprintf(run->usageLog, ",,,,\n");
+	}
+	fflush(run->usageLog);
+}
+
+void _sample_onTimer(void * owner, uint32_t events){
+	uint64_t expirations;
+	while( read(sampleWatch.fd, &expirations, sizeof(expirations)) == sizeof(expirations) );
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	for (Run* run = liveHead; run; run = run->next) {
+		if( !run->exited && run->runType != CONTROL ) _run_sample(run, &now);
+	}
+}
+
+void _sample_init(){
+	_watch_init(&sampleWatch, &_sample_onTimer, NULL);
+	if( sampleMillis <= 0 ) return;
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = sampleMillis / 1000;
+	spec.it_interval.tv_nsec = (sampleMillis % 1000) * 1000000;
+	spec.it_value = spec.it_interval;
+	if( fd == -1 || -1 == timerfd_settime(fd, 0, &spec, NULL) || -1 == _watch_add(&sampleWatch, fd, EPOLLIN) ){
+		fprintf(stderr,"usage sampler failed. errno:%s(%d) \n", strerror(errno),errno);
+		if( fd > -1 ) close(fd);
+	}
+}
+
+static void _ctrlRun_init(Run* run){
+	ctrlRun = run;
+	_run_mkdir(run);
+	runningPath = strdup(_run_path(ctrlRun,DEFAULT,RUNNING_FILE));
+	journalPath = strdup(_run_path(ctrlRun,DEFAULT,JOURNAL_FILE));
+	journal = fopen(journalPath,"we");
+	journalCompacted = time(0);
+	_status_init(_run_path(ctrlRun,DEFAULT,STATUS_FILE));
+	invoked = fopen(_run_path(ctrlRun,DEFAULT,INVOKED_FILE),"we");
+	fprintf(invoked, "id,pid,runType,startTime,statusDirectory,job,cmd\n");
+	queued = fopen(_run_path(ctrlRun,DEFAULT,QUEUED_FILE),"we");
+	fprintf(queued, "job,priority,queuedTime,cmd\n");
+    finished = fopen(_run_path(ctrlRun,DEFAULT,FINISHED_FILE),"we");
+    fprintf(finished, "id,pid,runType,returnCode,startTime,endTime,duration,statusDirectory,outBytes,outDropped,outSegments,errBytes,errDropped,errSegments,userCpu,systemCpu,maxRssKb,minorFaults,majorFaults,voluntarySwitches,involuntarySwitches,blocksIn,blocksOut,startUs,endUs,durationUs,reason,job,attempt,cmd\n");
+
+}
+
+
+static char * _tmp_path(const char * path){
+	snprintf(buff,sizeof(buff),"%s.tmp",path);
+	return buff;
+}
+
+/*
+ Writes file under temporary name and renames it into place, so readers
+ see either old or new content; with <sync> also after crash.
+*/
+FILE * _atomic_open(const char * path){
+	return fopen(_tmp_path(path),"we");
+}
+
+bool _atomic_commit(FILE * f, const char * path, bool sync){
+	fflush(f);
+	if( sync ) fdatasync(fileno(f));
+	char * tmp = strdup(_tmp_path(path));
+	bool ok = 0 == rename(tmp, path);
+	if( !ok ){
+		fprintf(stderr,"rename %s -> %s failed. errno:%s(%d) \n", tmp, path, strerror(errno),errno);
+	}
+	free(tmp);
+	return ok;
+}
+
+void _running_header(FILE * running){
+	fprintf(running, "id,pid,runType,startTime,duration,statusDirectory,cmd\n");
+}
+
+void _running_line(FILE * running, const char * id, pid_t pid, const char * runType,
+		time_t start, long duration, const char * dir, const char * cmd){
+	char stamp[TIMESTAMP_SIZE];
+	fprintf(running, "%s,%d,%s,%s,%ld,%s,%s\n",
+			id, pid, runType, _timestamp(start, stamp), duration, dir, cmd);
+}
+
+void _runs_updateRunning(){
+	FILE * running =  _atomic_open(runningPath);
+	_running_header(running);
+	uint64_t now = _clock_ns(CLOCK_MONOTONIC);
+	for (Run* run = liveHead; run; run = run->next) {
+		_running_line(running, run->id, run->pid, runTypeNames[run->runType],
+				run->start, (now - run->startMono) / 1000000000,
+				_run_path(run,DEFAULT,DIRECTORY), run->cmd);
+	}
+	/* journal is what survives crash, --replay rebuilds running.csv */
+	_atomic_commit(running, runningPath, false);
+	fclose(running);
+}
+
+void _journal_add(FILE * f, Run * run){
+	fprintf(f, "+%s,%d,%s,%ld,%s,%s\n", run->id, run->pid, runTypeNames[run->runType],
+			run->start, _run_path(run,DEFAULT,DIRECTORY), run->cmd);
+}
+
+void _journal_started(Run * run){
+	_journal_add(journal, run);
+	journalRecords += 1;
+	journalDirty = true;
+}
+
+void _journal_finished(Run * run){
+	fprintf(journal, "-%s\n", run->id);
+	journalRecords += 1;
+	journalDirty = true;
+}
+
+/*
+ Replaces journal with records of live runs only.
+*/
+void _journal_compact(){
+	FILE * f = _atomic_open(journalPath);
+	int records = 0;
+	for (Run* run = liveHead; run; run = run->next) {
+		_journal_add(f, run);
+		records += 1;
+	}
+	if( _atomic_commit(f, journalPath, true) ){
+		fclose(journal);
+		journal = f;
+		journalRecords = records;
+	}else{
+		fclose(f);
+	}
+	journalCompacted = time(0);
+	_timer_stop(&compactTimer);
+	_runs_updateRunning();
+}
+
+static void _journal_onCompactTimer(void * owner){
+	_journal_compact();
+}
+
+/*
+ Called once per loop iteration, so runs started or finished together
+ cost one running.csv. Loop may sleep in epoll_wait long after last
+ change, so compaction not due yet is left to timer.
+*/
+void _state_flush(){
+	if( !journalDirty ) return;
+	journalDirty = false;
+	fflush(journal);
+	long age = time(0) - journalCompacted;
+	if( journalRecords >= JOURNAL_COMPACT_RECORDS || age >= JOURNAL_COMPACT_SECONDS ){
+		_journal_compact();
+		return;
+	}
+	_runs_updateRunning();
+	if( !compactTimer.pprev ){
+		_timer_start(&compactTimer, (JOURNAL_COMPACT_SECONDS - age) * 1000, &_journal_onCompactTimer, NULL);
+	}
+}
+
+typedef struct {
+	char * id;
+	char * rest;
+	bool live;
+} ReplayRecord;
+
+/*
+ Rebuilds running.csv of control status directory from running.journal.
+ Journal may have been compacted after records it holds were appended,
+ so repeated start and unknown finish records are tolerated.
+*/
+int _replay(const char * dir){
+	snprintf(buff, sizeof(buff), "%s%s", dir, pathSuffix[JOURNAL_FILE]);
+	FILE * f = fopen(buff, "r");
+	if( !f ){
+		fprintf(stderr,"cannot open %s. errno:%s(%d) \n", buff, strerror(errno),errno);
+		return EXIT_FAILURE;
+	}
+	int count = 0, size = 1024;
+	ReplayRecord * records = malloc(sizeof(ReplayRecord) * size);
+	for (indexMask = 1; indexMask < (unsigned)size * 2; indexMask <<= 1);
+	int * index = malloc(sizeof(int) * indexMask);
+	memset(index, -1, sizeof(int) * indexMask);
+	indexMask -= 1;
+	char * line = NULL;
+	size_t lineSize = 0;
+	ssize_t len;
+	while( (len = getline(&line, &lineSize, f)) > 0 ){
+		if( line[len-1] != '\n' ) break; /* torn tail */
+		line[len-1] = 0;
+		char * comma = strchr(line + 1, ',');
+		if( comma ) *comma = 0;
+		unsigned h = _hash_id(line + 1);
+		while( index[h] != -1 && strcmp(records[index[h]].id, line + 1) ) h = (h + 1) & indexMask;
+		if( line[0] == '+' && comma ){
+			if( index[h] == -1 ){
+				if( count * 2 >= (int)indexMask ) {
+					/* grow and rehash */
+					size *= 2;
+					records = realloc(records, sizeof(ReplayRecord) * size);
+					for (indexMask = 1; indexMask < (unsigned)size * 2; indexMask <<= 1);
+					index = realloc(index, sizeof(int) * indexMask);
+					memset(index, -1, sizeof(int) * indexMask);
+					indexMask -= 1;
+					for (int i = 0; i < count; ++i) {
+						unsigned r = _hash_id(records[i].id);
+						while( index[r] != -1 ) r = (r + 1) & indexMask;
+						index[r] = i;
+					}
+					h = _hash_id(line + 1);
+					while( index[h] != -1 ) h = (h + 1) & indexMask;
+				}
+				index[h] = count;
+				records[count].id = strdup(line + 1);
+				records[count].rest = NULL;
+				count += 1;
+			}
+			ReplayRecord * r = records + index[h];
+			free(r->rest);
+			r->rest = strdup(comma + 1);
+			r->live = true;
+		}else if( line[0] == '-' && index[h] != -1 ){
+			records[index[h]].live = false;
+		}
+	}
+	fclose(f);
+	free(line);
+	snprintf(buff, sizeof(buff), "%s%s", dir, pathSuffix[RUNNING_FILE]);
+	char * path = strdup(buff);
+	FILE * running = _atomic_open(path);
+	_running_header(running);
+	for (int i = 0; i < count; ++i) {
+		ReplayRecord * r = records + i;
+		if( !r->live ) continue;
+		/* rest is pid,runType,startTime,statusDirectory,cmd */
+		char * fields[5];
+		char * p = r->rest;
+		int n = 0;
+		for (; n < 4 && p; ++n) {
+			fields[n] = p;
+			if( (p = strchr(p, ',')) ) *p++ = 0;
+		}
+		if( n < 4 || !p ) continue;
+		fields[4] = p;
+		time_t start = atol(fields[2]);
+		_running_line(running, r->id, atoi(fields[0]), fields[1], start, time(0) - start, fields[3], fields[4]);
+	}
+	bool ok = _atomic_commit(running, path, true);
+	fclose(running);
+	puts(path);
+	free(path);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+void _input_start(Job * job, int fd);
+
+void _queue_push(Job * job);
+
+/*
+ Returns NULL when pipes could not be created, job is queued again.
+*/
+Run * _run_new(char ** cmd,RunType runType,Job * job){
+	int  runPipes[6];
+	int pipes = runType==CONTROL || (job && job->input) ? 3 : 2;
+	int opened = 0;
+	while( opened < pipes && 0 == pipe2(runPipes + opened * 2, O_CLOEXEC) ) opened += 1;
+	if( opened < pipes ){
+		fprintf(stderr,"pipe failed. errno:%s(%d) cmd:%s\n", strerror(errno), errno, cmd[0]);
+		while( opened-- > 0 ){
+			close(runPipes[opened * 2]);
+			close(runPipes[opened * 2 + 1]);
+		}
+		if( !job ) exit(1);
+		_queue_push(job);
+		return NULL;
+	}
+	time_t tt = time(0);
+	SpawnPlan plan;
+	_plan_init(&plan, cmd, runType, tt);
+	if(runType==CONTROL || (job && job->input))
+		plan.dups[STDIN_FILENO] = runPipes[4];
+	plan.dups[STDOUT_FILENO] = runPipes[1];
+	plan.dups[STDERR_FILENO] = runPipes[3];
+	char * cgroup = NULL;
+	if( job ){
+		_plan_limits(&plan, job);
+		_plan_environment(&plan, job);
+		if( cgroupRoot ) cgroup = _cgroup_create(job, &plan);
+	}
+	pid_t pid = (*spawnEngine->spawn)(&plan);
+	if( plan.cgroupProcs > -1 ) close(plan.cgroupProcs);
+	if( plan.envp != environ ) free(plan.envp);
+	if( pid == -1 ){
+		perror(spawnEngine->name);
+		exit(1);
+	}
+	if( plan.pgroup ) setpgid(pid, pid);
+	if( plan.err ){
+		fprintf(stderr, "failed to execute errno:%s(%d) cmd:%s\n", strerror(plan.err),plan.err, cmd[0]);
+	}
+	Run * run = _runs_add(runType,tt,pid,cmd);
+	run->job = job;
+	run->cgroup = cgroup;
+	run->worker = NULL;
+	run->uring = false;
+	if(runType != CONTROL) runningCount += 1;
+	run->fds = _run_fds(job);
+	fdsInUse += run->fds;
+	_run_watchExit(run);
+	if( job ){
+		job->run = run;
+		_run_deadline(run);
+	}
+	close(runPipes[1]);
+	close(runPipes[3]);
+	if(runType==CONTROL){
+		close(runPipes[4]);
+		run->control_in = runPipes[5];
+		_fd_setNonBlocking(run->control_in);
+		_watch_init(&controlInWatch, &_controlIn_onEvent, NULL);
+		_watch_add(&controlInWatch, run->control_in, EPOLLOUT);
+		_ctrlRun_init(run);
+	}else if(job && job->input){
+		close(runPipes[4]);
+		_input_start(job, runPipes[5]);
+	}
+	run->returnCode = 0;
+	memset(&(run->usage), 0, sizeof(run->usage));
+	run->usageLog = NULL;
+	_status_publish(run, STATUS_RUNNING);
+	_run_open(run,runPipes[0], runPipes[2]);
 	//TODO move to separate method
-	//id,pid,runType,startTime,statusDirectory,cmd
-	struct tm *start  = localtime(&(run->start));
-	fprintf(invoked,"%s,%d,%s," TIMESTAMP_TEMPLATE ",%s,%s\n",
+	//id,pid,runType,startTime,statusDirectory,job,cmd
+	char stamp[TIMESTAMP_SIZE];
+	fprintf(invoked,"%s,%d,%s,%s,%s,%s,%s\n",
 			run->id,
 			run->pid,
 			runTypeNames[run->runType],
-			TIMESTAMP_EXTRACT(start),
+			_timestamp(run->start, stamp),
 			_run_path(run,DEFAULT,DIRECTORY),
+			job ? job->name : "",
 			run->cmd
 	);
-	_runs_updateRunning();
+	fflush(invoked);
+	_journal_started(run);
+	if( job ){
+		char pid[16], start[24];
+		snprintf(pid, sizeof(pid), "%d", run->pid);
+		snprintf(start, sizeof(start), "%ld", run->start);
+		const char * f[] = { job->name, run->id, pid, start, _run_path(run,DEFAULT,DIRECTORY) };
+		_control_event("started", 5, f);
+	}
 	return run;
 }
 
+/*
+ Pending jobs are kept in binary heap: highest priority first,
+ then in order of submission.
+*/
+static Job ** queue;
+static int queueLength = 0;
+static int queueSize = 0;
+static int maxQueue = 100000;
+static int maxRunning = 0;
+static int heldJobs = 0;
+static bool controlPaused = false;
+
+static bool _job_before(Job * a, Job * b){
+	return a->priority > b->priority || (a->priority == b->priority && a->seq < b->seq);
+}
+
+void _queue_push(Job * job){
+	if( queueLength == queueSize ){
+		queueSize = queueSize ? queueSize * 2 : 64;
+		queue = realloc(queue, sizeof(Job*) * queueSize);
+	}
+	int i = queueLength++;
+	while( i > 0 && _job_before(job, queue[(i-1)/2]) ){
+		queue[i] = queue[(i-1)/2];
+		i = (i-1)/2;
+	}
+	queue[i] = job;
+}
+
+void _queue_remove(int i){
+	Job * last = queue[--queueLength];
+	if( i == queueLength ) return;
+	while( i > 0 && _job_before(last, queue[(i-1)/2]) ){
+		queue[i] = queue[(i-1)/2];
+		i = (i-1)/2;
+	}
+	for(;;){
+		int child = i*2 + 1;
+		if( child >= queueLength ) break;
+		if( child + 1 < queueLength && _job_before(queue[child+1], queue[child]) ) child += 1;
+		if( !_job_before(queue[child], last) ) break;
+		queue[i] = queue[child];
+		i = child;
+	}
+	queue[i] = last;
+}
+
+Job * _queue_pop(){
+	Job * top = queue[0];
+	_queue_remove(0);
+	return top;
+}
+
+#define MAX_INPUT_QUEUED 0x4000000 // 64M
+static size_t inputQueued = 0;
+
+/*
+ Control output is not processed while queue is full, or too much stdin
+ input waits for jobs, so control process blocks on its stdout. After
+ control exited, what it left in its pipe is read the same way: control
+ run is kept draining and freed once pipe is empty.
+*/
+static bool controlDraining = false;
+
+bool _queue_full(){
+	controlPaused = (queueLength >= maxQueue || inputQueued >= MAX_INPUT_QUEUED) && ctrlRun;
+	return controlPaused;
+}
+
+static bool _control_drained(){
+	return ctrlRun->std_out.empty && !controlPaused;
+}
+
+void _process_control_output(Buff* buff);
+
+void _control_resume(){
+	if( controlPaused && ctrlRun && !_queue_full() ){
+		_process_control_output(&controlBuffer);
+		_pipe_capture(&(ctrlRun->std_out));
+	}
+}
+
+/*
+ Besides free slot, job needs descriptors: jobs with more of them than
+ slots were sized for (index=, stdin=pipe) wait until enough are free.
+*/
+bool _jobs_canStart(Job * job){
+	return runningCount < maxRunning && freeRuns
+			&& fdsInUse + _run_fds(job) + SPAWN_FDS <= fdLimit - RESERVED_FDS;
+}
+
+/*
+ Job started with stdin=pipe gets pipe written by gopard. Input control
+ sends is queued per job, also while job waits in queue, and written
+ without blocking as job reads it. Files are spliced into pipe. After
+ eof pipe is closed once queue is written; if job exits or closes its
+ stdin earlier, rest of input is dropped.
+*/
+typedef struct InputChunk {
+	struct InputChunk * next;
+	int fd;
+	size_t size;
+	size_t offset;
+	char data[];
+} InputChunk;
+
+typedef struct JobInput {
+	Watch watch;
+	InputChunk * head;
+	InputChunk * tail;
+	bool eof;
+	bool closed;
+} JobInput;
+
+void _input_onEvent(void * owner, uint32_t events);
+
+JobInput * _input_new(Job * job){
+	JobInput * input = calloc(1, sizeof(JobInput));
+	_watch_init(&input->watch, &_input_onEvent, job);
+	return input;
+}
+
+static void _input_next(JobInput * input){
+	InputChunk * chunk = input->head;
+	input->head = chunk->next;
+	if( !input->head ) input->tail = NULL;
+	if( chunk->fd > -1 ) close(chunk->fd);
+	inputQueued -= chunk->size - chunk->offset;
+	free(chunk);
+}
+
+static void _input_close(JobInput * input){
+	_watch_close(&input->watch);
+	while( input->head ) _input_next(input);
+	input->closed = true;
+}
+
+void _input_free(Job * job){
+	_input_close(job->input);
+	free(job->input);
+	job->input = NULL;
+}
+
+static InputChunk * _input_chunk(JobInput * input, size_t size, int fd){
+	InputChunk * chunk = malloc(sizeof(InputChunk) + size);
+	chunk->next = NULL;
+	chunk->fd = fd;
+	chunk->size = size;
+	chunk->offset = 0;
+	return chunk;
+}
+
+static void _input_append(JobInput * input, InputChunk * chunk){
+	if( input->tail ) input->tail->next = chunk; else input->head = chunk;
+	input->tail = chunk;
+	inputQueued += chunk->size;
+}
+
+/*
+ Reads next block of file into data chunk ahead of file chunk, when
+ file system can't splice.
+*/
+static bool _input_readFile(JobInput * input, InputChunk * file){
+	InputChunk * chunk = _input_chunk(input, SPLICE_CHUNK / 16, -1);
+	ssize_t n = read(file->fd, chunk->data, chunk->size);
+	if( n <= 0 ){
+		free(chunk);
+		return false;
+	}
+	chunk->size = n;
+	chunk->next = file;
+	input->head = chunk;
+	inputQueued += n;
+	return true;
+}
+
+void _input_flush(JobInput * input){
+	int out = input->watch.fd;
+	while( input->head && out > -1 ){
+		InputChunk * chunk = input->head;
+		ssize_t n;
+		if( chunk->fd > -1 ){
+			n = splice(chunk->fd, NULL, out, NULL, SPLICE_CHUNK, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+			if( n < 0 && errno == EINVAL ){
+				if( !_input_readFile(input, chunk) ) _input_next(input);
+				continue;
+			}
+			if( n == 0 ) _input_next(input);
+		}else{
+			n = write(out, chunk->data + chunk->offset, chunk->size - chunk->offset);
+			if( n > 0 ){
+				chunk->offset += n;
+				inputQueued -= n;
+				if( chunk->offset == chunk->size ) _input_next(input);
+			}
+		}
+		if( n < 0 ){
+			if( errno == EINTR ) continue;
+			if( errno == EAGAIN ) return;
+			if( errno != EPIPE ){
+				fprintf(stderr,"stdin write failed. errno:%s(%d)\n", strerror(errno), errno);
+			}
+			_input_close(input);
+			return;
+		}
+	}
+	if( input->eof && !input->head ) _input_close(input);
+}
+
+void _input_onEvent(void * owner, uint32_t events){
+	Job * job = owner;
+	_input_flush(job->input);
+	_control_resume();
+}
+
+void _input_start(Job * job, int fd){
+	JobInput * input = job->input;
+	if( input->closed ){
+		close(fd);
+		return;
+	}
+	_fd_setNonBlocking(fd);
+	if( -1 == _watch_add(&input->watch, fd, EPOLLOUT) ){
+		close(fd);
+		_input_close(input);
+		return;
+	}
+	_input_flush(input);
+}
+
+JobInput * _input_find(const char * name){
+	Job * job = _job_find(name);
+	if( !job || !job->input ){
+		fprintf(stderr,"No job with stdin=pipe named=%s\n", name);
+		return NULL;
+	}
+	if( job->input->eof ){
+		fprintf(stderr,"Input of job=%s is closed\n", name);
+		return NULL;
+	}
+	return job->input;
+}
+
+void _input_write(const char * name, const char * data, size_t size, bool newline){
+	JobInput * input = _input_find(name);
+	if( !input ) return;
+	if( input->closed ) return;
+	InputChunk * chunk = _input_chunk(input, size + newline, -1);
+	memcpy(chunk->data, data, size);
+	if( newline ) chunk->data[size] = '\n';
+	_input_append(input, chunk);
+	_input_flush(input);
+}
+
+void _input_file(const char * name, const char * path){
+	JobInput * input = _input_find(name);
+	if( !input ) return;
+	int fd = open(path, O_RDONLY|O_CLOEXEC);
+	if( fd == -1 ){
+		fprintf(stderr,"cannot open %s. errno:%s(%d)\n", path, strerror(errno), errno);
+		return;
+	}
+	if( input->closed ){
+		close(fd);
+		return;
+	}
+	_input_append(input, _input_chunk(input, 0, fd));
+	_input_flush(input);
+}
+
+void _input_eof(const char * name){
+	JobInput * input = _input_find(name);
+	if( !input ) return;
+	input->eof = true;
+	_input_flush(input);
+}
+
+void _job_invoked(Job * job, RunType state){
+	char priority[16];
+	snprintf(priority, sizeof(priority), "%d", job->priority);
+	const char * f[] = { job->name, runTypeNames[state], priority, formatCmd(job->argv) };
+	_control_event("invoked", 4, f);
+}
+
+/*
+ Job submitted with after=/afterany= waits for its prerequisites as HELD.
+ Every prerequisite still running or queued links an Edge of the waiting
+ job into its dependants; when prerequisite settles, waiting job is
+ started or, if required prerequisite failed, skipped, which settles it
+ as failed in turn.
+*/
+typedef struct Edge {
+	Job * prereq;
+	Job * job;
+	bool any;
+	struct Edge * next;
+	struct Edge ** pprev;
+} Edge;
+
+typedef struct Outcome {
+	struct Outcome * next;
+	struct Outcome ** pprev;
+	struct Outcome * newer;
+	bool ok;
+	char name[24];
+} Outcome;
+
+/*
+ Outcomes of finished jobs are kept oldest first, the oldest is forgotten
+ when there are MAX_OUTCOMES of them.
+*/
+#define MAX_OUTCOMES 0x10000
+
+static Outcome * outcomes[JOB_INDEX];
+static Outcome * oldestOutcome = NULL;
+static Outcome * newestOutcome = NULL;
+static int outcomeCount = 0;
+
+static Outcome * _outcome_find(const char * name){
+	Outcome * o = outcomes[_hash_string(name) & (JOB_INDEX - 1)];
+	while( o && strcmp(o->name, name) ) o = o->next;
+	return o;
+}
+
+static void _outcome_forget(){
+	Outcome * o = oldestOutcome;
+	oldestOutcome = o->newer;
+	if( !oldestOutcome ) newestOutcome = NULL;
+	*(o->pprev) = o->next;
+	if( o->next ) o->next->pprev = o->pprev;
+	outcomeCount -= 1;
+	free(o);
+}
+
+static void _outcome_add(const char * name, bool ok){
+	Outcome * o = _outcome_find(name);
+	if( !o ){
+		if( outcomeCount == MAX_OUTCOMES ) _outcome_forget();
+		Outcome ** bucket = outcomes + (_hash_string(name) & (JOB_INDEX - 1));
+		o = malloc(sizeof(Outcome));
+		strcpy(o->name, name);
+		o->next = *bucket;
+		if( o->next ) o->next->pprev = &(o->next);
+		o->pprev = bucket;
+		*bucket = o;
+		o->newer = NULL;
+		if( newestOutcome ) newestOutcome->newer = o; else oldestOutcome = o;
+		newestOutcome = o;
+		outcomeCount += 1;
+	}
+	o->ok = ok;
+}
+
+static void _edge_unlink(Edge * edge){
+	*(edge->pprev) = edge->next;
+	if( edge->next ) edge->next->pprev = edge->pprev;
+	edge->prereq = NULL;
+}
+
+void _job_start(Job * job);
+void _job_skip(Job * job);
+
+static void _job_skipped(Job * job){
+	const char * f[] = { job->name };
+	_control_event("skipped", 1, f);
+}
+
+/*
+ Dependants skipped on the way are settled from worklist, not by nested
+ calls, so long after= chains don't grow stack.
+*/
+void _job_settle(Job * job, bool ok){
+	Job * skipped = NULL;
+	Job * settling = job;
+	for(;;){
+		if( settling->named ) _outcome_add(settling->name, ok);
+		while( settling->dependants ){
+			Edge * edge = settling->dependants;
+			Job * dependant = edge->job;
+			_edge_unlink(edge);
+			if( !ok && !edge->any ) dependant->depFailed = true;
+			if( --dependant->waiting == 0 ){
+				heldJobs -= 1;
+				if( dependant->depFailed ){
+					dependant->skipNext = skipped;
+					skipped = dependant;
+				}else{
+					_job_start(dependant);
+				}
+			}
+		}
+		if( settling != job ) _job_free(settling);
+		if( !skipped ) return;
+		settling = skipped;
+		skipped = settling->skipNext;
+		ok = false;
+		_job_skipped(settling);
+	}
+}
+
+void _job_skip(Job * job){
+	_job_skipped(job);
+	_job_settle(job, false);
+	_job_free(job);
+}
+
+void _job_unhold(Job * job){
+	for (int i = 0; i < job->edgeCount; ++i) {
+		if( job->edges[i].prereq ) _edge_unlink(job->edges + i);
+	}
+	job->waiting = 0;
+	heldJobs -= 1;
+}
+
+static int _job_linkAfter(Job * job, char * names, bool any){
+	int count = 0;
+	for (char * name = strtok(names, ","); name; name = strtok(NULL, ",")) {
+		Job * prereq = _job_find(name);
+		if( prereq && prereq != job ){
+			Edge * edge = job->edges + job->edgeCount++;
+			edge->prereq = prereq;
+			edge->job = job;
+			edge->any = any;
+			edge->next = prereq->dependants;
+			if( edge->next ) edge->next->pprev = &(edge->next);
+			edge->pprev = &(prereq->dependants);
+			prereq->dependants = edge;
+			count += 1;
+			continue;
+		}
+		Outcome * o = prereq ? NULL : _outcome_find(name);
+		if( !o ) fprintf(stderr,"Unknown job=%s in after list of job=%s\n", name, job->name);
+		if( !any && !(o && o->ok) ) job->depFailed = true;
+	}
+	return count;
+}
+
+/*
+ Returns true when job has to wait for prerequisites or was skipped.
+*/
+bool _job_hold(Job * job){
+	if( !job->after[0] && !job->after[1] ) return false;
+	int edges = 0;
+	for (int any = 0; any < 2; ++any) {
+		for (char * p = job->after[any]; p && *p; ++p) edges += *p == ',';
+		if( job->after[any] ) edges += 1;
+	}
+	job->edges = calloc(edges, sizeof(Edge));
+	job->waiting = _job_linkAfter(job, job->after[0], false);
+	job->waiting += _job_linkAfter(job, job->after[1], true);
+	if( job->waiting == 0 ){
+		if( !job->depFailed ) return false;
+		_job_skip(job);
+		return true;
+	}
+	heldJobs += 1;
+	_job_invoked(job, HELD);
+	return true;
+}
+
+void _job_cancel(const char * name){
+	Job * job = _job_find(name);
+	if( !job ){
+		fprintf(stderr,"No job named=%s\n", name);
+		return;
+	}
+	if( job->run ){
+		_run_terminate(job->run, "cancel");
+		return;
+	}
+	for (int i = 0; i < queueLength; ++i) {
+		if( queue[i] == job ){
+			_queue_remove(i);
+			break;
+		}
+	}
+	if( job->retryTimer.pprev ) heldJobs -= 1;
+	if( job->waiting ) _job_unhold(job);
+	const char * f[] = { job->name };
+	_control_event("cancelled", 1, f);
+	_job_settle(job, false);
+	_job_free(job);
+	_control_resume();
+}
+
+void _job_start(Job * job){
+	if( queueLength == 0 && _jobs_canStart(job) ){
+		_job_invoked(job, RUNNING);
+		_run_new(job->argv,RUNNING,job);
+		return;
+	}
+	_job_invoked(job, QUEUED);
+	job->queued = time(0);
+	_queue_push(job);
+	//job,priority,queuedTime,cmd
+	char stamp[TIMESTAMP_SIZE];
+	fprintf(queued,"%s,%d,%s,%s\n",
+			job->name, job->priority, _timestamp(job->queued, stamp), formatCmd(job->argv));
+}
+
+void _job_submit(Job * job){
+	_job_index(job);
+	if( job->stdinPipe ) job->input = _input_new(job);
+	if( _job_hold(job) ) return;
+	_job_start(job);
+}
+
+/*
+ Failed job with retries left is started again after backoff under same
+ job name, every attempt with its own run id and status directory.
+ Delay doubles with every attempt, capped at MAX_BACKOFF, and its upper
+ half is random so retries of jobs failed together spread out.
+*/
+#define MAX_BACKOFF 300000
+
+static bool _job_retryable(Job * job, Run * run){
+	if( job->attempt > job->retries || job->input || 0 == strcmp(run->reason, "cancel") ){
+		return false;
+	}
+	int status = run->returnCode;
+	bool exited = WIFEXITED(status) && 0 == strcmp(run->reason, "exit");
+	if( exited && WEXITSTATUS(status) == 0 ) return false;
+	uint64_t any = job->retryOn[0] | job->retryOn[1] | job->retryOn[2] | job->retryOn[3];
+	if( !any ) return true;
+	return exited && (job->retryOn[WEXITSTATUS(status) / 64] >> (WEXITSTATUS(status) % 64) & 1);
+}
+
+static void _job_onRetry(void * owner){
+	heldJobs -= 1;
+	_job_start(owner);
+	fflush(queued);
+}
+
+void _job_settle(Job * job, bool ok);
+
+void _job_done(Run * run){
+	Job * job = run->job;
+	if( !_job_retryable(job, run) ){
+		int status = run->returnCode;
+		_job_settle(job, WIFEXITED(status) && WEXITSTATUS(status) == 0 && 0 == strcmp(run->reason, "exit"));
+		_job_free(job);
+		return;
+	}
+	long delay = job->backoff;
+	for (int i = 1; i < job->attempt && delay < MAX_BACKOFF; ++i) delay *= 2;
+	if( delay > MAX_BACKOFF ) delay = MAX_BACKOFF;
+	if( delay > 1 ) delay = delay / 2 + random() % (delay / 2 + 1);
+	job->run = NULL;
+	job->attempt += 1;
+	heldJobs += 1;
+	_timer_start(&(job->retryTimer), delay, &_job_onRetry, job);
+	char attempt[16], ms[24];
+	snprintf(attempt, sizeof(attempt), "%d", job->attempt);
+	snprintf(ms, sizeof(ms), "%ld", delay);
+	const char * f[] = { job->name, attempt, ms };
+	_control_event("retry", 3, f);
+}
+
+/*
+ Command is <name>:<argument> or <name>[<key=value> ...]:<argument>
+ returns offset of argument, or -1
+*/
+int _command_split(char * cmd, int sz, char ** options){
+	*options = NULL;
+	for (int i = 0; i < sz; ++i) {
+		if( cmd[i] == ':' ){
+			cmd[i] = 0;
+			return i + 1;
+		}
+		if( cmd[i] == '[' ){
+			cmd[i] = 0;
+			*options = cmd + i + 1;
+			int p = zapNextChar(cmd + i + 1, sz - i - 1, ']');
+			if( p == -1 || i + 1 + p >= sz || cmd[i + 1 + p] != ':' ) return -1;
+			return i + 2 + p;
+		}
+	}
+	return -1;
+}
+
+bool _job_parseOptions(Job * job, char * options){
+	int sz = strlen(options);
+	zapAll(options,sz,' ');
+	char ** pairs = extractStrings(options,sz);
+	bool ok = true;
+	for (char ** pair = pairs; *pair && ok; ++pair) {
+		char * value = strchr(*pair, '=');
+		if( value ) *value++ = 0;
+		if( !value ) fprintf(stderr,"Missing value of exec option=%s\n",*pair);
+		ok = value && _job_setOption(job, *pair, value);
+	}
+	free(pairs);
+	return ok;
+}
+
+void _exec_submit(char ** argv, char * options){
+	Job * job = _job_new(argv);
+	if( !options || !*options || _job_parseOptions(job, options) ){
+		if( _job_find(job->name) ){
+			fprintf(stderr,"Duplicate job id=%s\n", job->name);
+			_job_free(job);
+			return;
+		}
+		_job_submit(job);
+	}else{
+		_job_free(job);
+	}
+}
+
 void _processControlCommand(char * cmd){
 	int sz = strlen(cmd);
-	int p = zapNextChar(cmd,sz,':');
+	char * options;
+	int p = _command_split(cmd,sz,&options);
 	if(p == -1){
 		fprintf(stderr,"Unrecognized command=%s\n",cmd);
 	}else{
 		if(strcmp(cmd,"exec")==0){
 			zapAll(cmd+p,sz-p,' ');
 			char ** execStrings = extractStrings(cmd+p,sz-p);
-			_run_new(execStrings,RUNNING);
+			if( execStrings[0] ){
+				_exec_submit(execStrings, options);
+			}
 			free(execStrings);
+		}else if(strcmp(cmd,"stdin")==0){
+			char * text = strchr(cmd+p, ' ');
+			if( text ) *text++ = 0;
+			if( options && 0 == strncmp(options, "file=", 5) ){
+				_input_file(cmd+p, options + 5);
+			}else{
+				_input_write(cmd+p, text ? text : "", text ? strlen(text) : 0, true);
+			}
+		}else if(strcmp(cmd,"eof")==0){
+			_input_eof(cmd+p);
+		}else if(strcmp(cmd,"cancel")==0){
+			_job_cancel(cmd+p);
 		}else if(strcmp(cmd,"print")==0){
 			puts(cmd+p);
+		}else if(strcmp(cmd,"protocol")==0 && strcmp(cmd+p,"binary")==0){
+			binaryControl = true;
+			/* ack is first frame, before pending dropped count */
+			const char * f[] = { "binary" };
+			if( controlInWatch.fd > -1 && !_control_append("protocol", 1, f) ) droppedEvents += 1;
 		}else{
 			fprintf(stderr,"Unknown command=%s:%s\n",cmd,cmd+p);
 		}
@@ -552,85 +4644,417 @@ void _processControlCommand(char * cmd){
 
 }
 
-void _process_control_output(Buff* buff){
-	_buff_processLines(buff,&_processControlCommand);
+#define MAX_CONTROL_BUFFER 0x1000000 // 16M
+#define FRAME_EXEC  'x'
+#define FRAME_BATCH 'b'
+#define FRAME_PRINT 'p'
+#define FRAME_STDIN 's'
+#define FRAME_STDIN_FILE 'f'
+#define FRAME_CANCEL 'c'
+
+static char ** frameStrings;
+static uint32_t frameStringsSize = 0;
+static size_t controlSkip = 0;
+static bool controlSkipLine = false;
+
+static uint32_t _be32(const char * p){
+	const unsigned char * u = (const unsigned char *)p;
+	return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
 }
 
+/*
+ Points frameStrings at counted strings of payload in place,
+ returns number of strings or -1 if payload is malformed.
+*/
+int _frame_strings(char * p, uint32_t sz){
+	if( sz < 4 ) return -1;
+	uint32_t count = _be32(p);
+	if( count > sz / 5 ) return -1;
+	if( count + 1 > frameStringsSize ){
+		frameStringsSize = count + 1;
+		frameStrings = realloc(frameStrings, sizeof(char*) * frameStringsSize);
+	}
+	uint32_t off = 4;
+	for (uint32_t i = 0; i < count; ++i) {
+		if( sz - off < 4 ) return -1;
+		uint32_t len = _be32(p + off);
+		off += 4;
+		if( len == 0 || len > sz - off || p[off + len - 1] ) return -1;
+		frameStrings[i] = p + off;
+		off += len;
+	}
+	frameStrings[count] = NULL;
+	return count;
+}
 
-void _runs_processOutput(fd_set * set){
-	for (int runIdx = 0; runIdx < maxRun && runs[runIdx]; ++runIdx) {
-		Run* run =runs[runIdx];
-		if(run->runType == CONTROL){
-			_pipe_copy( &(run->std_out),set, &controlBuffer, &_process_control_output  );
+void _frame_process(char type, char * p, uint32_t sz){
+	int count;
+	switch(type){
+	case FRAME_EXEC:
+		count = _frame_strings(p, sz);
+		if( count < 2 ){
+			fprintf(stderr,"Malformed exec frame\n");
+		}else{
+			_exec_submit(frameStrings + 1, frameStrings[0]);
+		}
+		break;
+	case FRAME_BATCH:
+		while( sz >= 5 ){
+			uint32_t len = _be32(p);
+			if( len < 1 || len > sz - 4 || p[4] != FRAME_EXEC ) break;
+			_frame_process(p[4], p + 5, len - 1);
+			p += 4 + len;
+			sz -= 4 + len;
+		}
+		if( sz ) fprintf(stderr,"Malformed batch frame\n");
+		break;
+	case FRAME_PRINT:
+		if( _frame_strings(p, sz) == 1 ){
+			puts(frameStrings[0]);
+		}else{
+			fprintf(stderr,"Malformed print frame\n");
+		}
+		break;
+	case FRAME_STDIN:{
+		uint32_t len = sz >= 4 ? _be32(p) : 0;
+		if( len == 0 || len > sz - 4 || p[3 + len] ){
+			fprintf(stderr,"Malformed stdin frame\n");
+		}else if( len + 4 == sz ){
+			_input_eof(p + 4);
+		}else{
+			_input_write(p + 4, p + 4 + len, sz - 4 - len, false);
+		}
+		break;
+	}
+	case FRAME_STDIN_FILE:
+		if( _frame_strings(p, sz) == 2 ){
+			_input_file(frameStrings[0], frameStrings[1]);
+		}else{
+			fprintf(stderr,"Malformed stdin file frame\n");
+		}
+		break;
+	case FRAME_CANCEL:
+		if( _frame_strings(p, sz) == 1 ){
+			_job_cancel(frameStrings[0]);
 		}else{
-			_pipe_copy( &(run->std_out),set, &inputBuffer, &_buff_reset);
+			fprintf(stderr,"Malformed cancel frame\n");
+		}
+		break;
+	default:
+		fprintf(stderr,"Unknown frame type=%d\n", type);
+	}
+}
+
+/*
+ Processes one complete frame or line at head of buffer, returns
+ number of bytes consumed, 0 if more input needed.
+*/
+int _control_next(char * p, int sz){
+	if( binaryControl ){
+		if( sz < 4 ) return 0;
+		uint32_t len = _be32(p);
+		if( len > MAX_CONTROL_BUFFER - 4 ){
+			fprintf(stderr,"Control frame too large=%u\n", len);
+			controlSkip = (size_t)len + 4;
+			return 0;
 		}
-		_pipe_copy( &(run->std_err),set, &inputBuffer, &_buff_reset);
+		if( len < 1 || (uint32_t)sz - 4 < len ) return len < 1 ? 4 : 0;
+		_frame_process(p[4], p + 5, len - 1);
+		return 4 + len;
 	}
+	int next = zapNextChar(p, sz, '\n');
+	if( next == -1 ) return 0;
+	if( controlSkipLine ){
+		controlSkipLine = false;
+	}else{
+		_processControlCommand(p);
+	}
+	return next;
+}
+
+/*
+ Control buffer grows up to MAX_CONTROL_BUFFER to hold one complete line
+ or frame. Larger ones are skipped.
+*/
+void _process_control_output(Buff* buff){
+	int p = 0;
+	for(;;){
+		if( controlSkip ){
+			int n = controlSkip < (size_t)(buff->used - p) ? (int)controlSkip : buff->used - p;
+			controlSkip -= n;
+			p += n;
+			if( controlSkip ) break;
+		}
+		if( _queue_full() ) break;
+		int n = _control_next(buff->head + p, buff->used - p);
+		if( n == 0 && !controlSkip ) break;
+		p += n;
+	}
+	_buff_consume(buff, p);
+	if( _buff_left(buff) == 0 && !controlPaused && !_buff_grow(buff, MAX_CONTROL_BUFFER) ){
+		fprintf(stderr,"Control line too long, skipped\n");
+		controlSkipLine = true;
+		_buff_reset(buff);
+	}
+}
+
+void _jobs_schedule(){
+	bool started = false;
+	while( queueLength > 0 && _jobs_canStart(queue[0]) ){
+		Job * job = _queue_pop();
+		started = true;
+		if( !_run_new(job->argv,RUNNING,job) ) break;
+	}
+	if( started ) fflush(queued);
+	_control_resume();
 }
 
+
+/*
+ Runs are marked exited by pidfd/signalfd events, and finalized here
+ after event batch is dispatched, so no pending event refers to freed run.
+*/
 int _runs_checkForTerminatedJobs(){
-	int status;
-	pid_t pid ;
-	bool changes = false;
-	while((pid =waitpid(-1,&status, WNOHANG)) > 0 ){
-		bool collapse = false ;
-		changes = true;
-		for (int runIdx = 0; runIdx < maxRun && runs[runIdx]; ++runIdx) {
-			Run* run = runs[runIdx];
-			if( run->pid ==  pid ){
-				run->returnCode = status;
-				run->end = time(0);
-				_run_free(run);
-				collapse = true;
-			}
-			if(collapse){
-				runs[runIdx] = runs[runIdx+1];
+	if( exitedHead ){
+		for (Run* run = exitedHead; run; run = run->exitedNext) {
+			if( run == ctrlRun ) _process_control_output(&controlBuffer);
+			_pipe_capture(&(run->std_out));
+			_pipe_capture(&(run->std_err));
+		}
+		while( exitedHead ){
+			Run* run = exitedHead;
+			exitedHead = run->exitedNext;
+			if( run == ctrlRun && !_control_drained() ){
+				controlDraining = true;
+				continue;
 			}
+			_run_free(run);
 		}
+		exitedTail = NULL;
+		fflush(finished);
+		_jobs_schedule();
 	}
-	if(changes==true){
-		_runs_updateRunning();
+	if( controlDraining && _control_drained() ){
+		controlDraining = false;
+		_run_free(ctrlRun);
+		fflush(finished);
 	}
-	return runs[0] != NULL;
+	return liveHead != NULL || heldJobs > 0;
 }
 
 
+static void usage(){
+	printf("USAGE: gopard [options] <output directory> <control process command and arguments> \n"
+			"  --spawn=vfork|fork    how jobs are spawned (default vfork)\n"
+			"  --capture=copy|splice how job output is moved into logs (default copy)\n"
+			"  --pipe-size=<bytes>   grow job pipes with F_SETPIPE_SZ\n"
+			"  --compress=<bytes>    gzip job logs in frames of <bytes> uncompressed\n"
+			"  --max-running=<n>     jobs running at once (default as many as fd limit allows)\n"
+			"  --max-queue=<n>       jobs waiting before control output is throttled (default 100000)\n"
+			"  --max-output=<bytes>  keep at most <bytes> of each job stream\n"
+			"  --rotate=<bytes>      start new job log segment every <bytes>\n"
+			"  --ring=<bytes>        keep first and last <bytes> of job log segments\n"
+			"  --index=<ms>          write time index of job output every <ms>\n"
+			"  --sample=<ms>         append /proc usage of running jobs to usage.csv every <ms>\n"
+			"  --cgroup=<dir>        put each job in its own cgroup under cgroup v2 <dir>\n"
+			"  --workers=<n>         capture job output in <n> threads\n"
+			"  --io=epoll|uring      how job pipes are read and logs written (default epoll)\n"
+			"  --write-buffer=<bytes> collect job logs in chunks written by writer thread\n"
+			"  --flush-ms=<ms>       write chunk older than <ms> (default 1000)\n"
+			"  --sync                fdatasync job logs when job finished\n"
+			"  --timeout=<ms>        terminate jobs running longer than <ms>\n"
+			"  --grace=<ms>          wait before SIGKILL follows SIGTERM (default 5000)\n"
+			"       gopard --replay=<control status directory>\n"
+			"  rebuild running.csv from running.journal\n"
+			"       gopard --lookup=<stdout.idx> <time>\n"
+			"  print offset,line,time of job output at <time>\n");
+}
+
 int main(int argc, char **argv) {
-	if ( argc < 3 ){
-    	printf("USAGE: gopard <output directory> <control process command and arguments> \n");
-    	return EXIT_FAILURE;
-    }
+	static struct option options[] = {
+			{ "spawn", required_argument, NULL, 's' },
+			{ "capture", required_argument, NULL, 'c' },
+			{ "pipe-size", required_argument, NULL, 'p' },
+			{ "compress", required_argument, NULL, 'z' },
+			{ "max-running", required_argument, NULL, 'r' },
+			{ "max-queue", required_argument, NULL, 'q' },
+			{ "max-output", required_argument, NULL, 'm' },
+			{ "rotate", required_argument, NULL, 'o' },
+			{ "ring", required_argument, NULL, 'g' },
+			{ "index", required_argument, NULL, 'i' },
+			{ "lookup", required_argument, NULL, 'L' },
+			{ "sample", required_argument, NULL, 'S' },
+			{ "cgroup", required_argument, NULL, 'C' },
+			{ "workers", required_argument, NULL, 'w' },
+			{ "io", required_argument, NULL, 'I' },
+			{ "write-buffer", required_argument, NULL, 'W' },
+			{ "flush-ms", required_argument, NULL, 'F' },
+			{ "sync", no_argument, NULL, 'Y' },
+			{ "timeout", required_argument, NULL, 'T' },
+			{ "grace", required_argument, NULL, 'G' },
+			{ "replay", required_argument, NULL, 'R' },
+			{ NULL, 0, NULL, 0 }
+	};
+	int opt;
+	while( -1 != (opt = getopt_long(argc, argv, "+s:c:p:z:r:q:m:o:g:i:L:S:C:w:I:W:F:YT:G:R:", options, NULL)) ){
+		switch(opt){
+		case 's':
+			for( spawnEngine = spawnEngines; spawnEngine->name && strcmp(spawnEngine->name, optarg); ++spawnEngine );
+			if( !spawnEngine->name ){
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'c':
+			if( 0 == strcmp(optarg, "splice") ){
+				spliceCapture = true;
+			}else if( 0 == strcmp(optarg, "copy") ){
+				spliceCapture = false;
+			}else{
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'p':
+			pipeSize = atoi(optarg);
+			break;
+		case 'z':
+#ifdef NO_ZLIB
+			fprintf(stderr,"gopard is built without zlib\n");
+			return EXIT_FAILURE;
+#endif
+			compressFrame = atol(optarg);
+			break;
+		case 'r':
+			maxRunning = atoi(optarg);
+			break;
+		case 'q':
+			maxQueue = atoi(optarg);
+			if( maxQueue < 1 ) maxQueue = 1;
+			break;
+		case 'm':
+			maxOutput = atol(optarg);
+			break;
+		case 'o':
+			rotateOutput = atol(optarg);
+			break;
+		case 'g':
+			ringOutput = atol(optarg);
+			break;
+		case 'i':
+			indexMillis = atol(optarg);
+			break;
+		case 'L':
+			if( optind >= argc ){
+				usage();
+				return EXIT_FAILURE;
+			}
+			return _timeIndex_lookup(optarg, argv[optind]);
+		case 'S':
+			sampleMillis = atol(optarg);
+			break;
+		case 'C':
+			cgroupRoot = optarg;
+			break;
+		case 'w':
+			workerCount = atoi(optarg);
+			break;
+		case 'W':
+			writeBuffer = atol(optarg);
+			break;
+		case 'F':
+			flushMillis = atol(optarg);
+			break;
+		case 'Y':
+			syncLogs = true;
+			break;
+		case 'T':
+			timeoutMillis = atol(optarg);
+			break;
+		case 'G':
+			graceMillis = atol(optarg);
+			break;
+		case 'I':
+			if( 0 == strcmp(optarg, "uring") ){
+				useUring = true;
+			}else if( 0 == strcmp(optarg, "epoll") ){
+				useUring = false;
+			}else{
+				usage();
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'R':
+			return _replay(optarg);
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if ( argc - optind < 2 ){
+		usage();
+		return EXIT_FAILURE;
+	}
     _runs_init();
-    realpath(argv[1],statusRoot);
-    realpath(argv[2],controlPath);
-    int nArgs = argc-2;
-    char ** cmd = malloc( sizeof(char*) * nArgs );
+    _children_init();
+    _sample_init();
+    _timer_init();
+    _cgroup_init();
+    _writer_init(1 + workerCount);
+    _flush_timer(epollFd, &flushWatch);
+    _writer_room(epollFd, &roomWatch, 0);
+    _workers_init();
+    _uring_init();
+    realpath(argv[optind],statusRoot);
+    realpath(argv[optind+1],controlPath);
+    int nArgs = argc-optind-1;
+    char ** cmd = malloc( sizeof(char*) * (nArgs+1) );
     _buff_allocate(&inputBuffer, 0x8000); // 32k
     _buff_allocate(&controlBuffer, 0x2000); // 8k
+    _buff_allocate(&controlOut, 0x2000); // 8k
+    _watch_init(&controlInWatch, &_controlIn_onEvent, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    srandom(time(0) ^ getpid());
     cmd[0]=controlPath;
     for (int iCmd = 1; iCmd < nArgs; ++iCmd) {
-    	cmd[iCmd] = argv[2+iCmd];
+    	cmd[iCmd] = argv[optind+1+iCmd];
 	}
-    _run_new(cmd,CONTROL);
-	struct timeval timeout;
+    cmd[nArgs] = NULL;
+    if( maxRunning <= 0 || maxRunning > maxRun - 1 ){
+    	maxRunning = maxRun - 1;
+    }
+    _run_new(cmd,CONTROL,NULL);
+    _journal_compact();
+	struct epoll_event events[MAX_EVENTS];
+	bool alive;
 	do{
-		timeout.tv_sec  = 10;
-		timeout.tv_usec = 0;
-		fd_set         input;
-		int n = select(_runs_prepareDescriptors(&input), &input, NULL, NULL, &timeout);
+		int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
 		/* See if there was an error */
-		if (n < 0){
-			perror("select failed");
-		}else if (n){
-			_runs_processOutput(&input);
+		if (n < 0 && errno != EINTR){
+			perror("epoll_wait failed");
+		}
+		for (int i = 0; i < n; ++i) {
+			Watch * watch = events[i].data.ptr;
+			(*watch->onEvent)(watch->owner, events[i].events);
 		}
-	}while(_runs_checkForTerminatedJobs());
+		_uring_flush();
+		alive = _runs_checkForTerminatedJobs();
+		_state_flush();
+		_control_flush();
+		_uring_submit();
+	}while(alive);
+    _uring_drain();
+    _workers_stop();
+    _writer_stop();
+    _journal_compact();
+    fclose(journal);
     free(cmd);
     fclose(invoked);
+    fclose(queued);
     fclose(finished);
     _buff_free(&inputBuffer);
     _buff_free(&controlBuffer);
+    _buff_free(&controlOut);
 }
 
 
@@ -0,0 +1,33 @@
+# after= skips propagate along chains, afterany= jobs run anyway
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	echo "exec[id=a]:/bin/false"
+	echo "exec[id=b after=a]:/bin/echo b"
+	echo "exec[id=c after=b]:/bin/echo c"
+	echo "exec[id=d afterany=a]:/bin/echo d"
+	echo "exec[id=e afterany=b]:/bin/echo e"
+	echo "exec[id=f after=d]:/bin/echo f"
+	while read -t 2 line; do echo "\$line" >&2; done
+	EOF
+)
+timeout 30 "$GOPARD" "$(status)" "$script" || fail "gopard failed"
+ran=$(jobs_column 28 | sort | tr '\n' ' ')
+[ "$ran" = "a d e f " ] || fail "jobs run: $ran"
+for job in b c; do
+	events | grep -q "^skipped:$job$" || fail "no skipped event of $job"
+done
+
+# cancelled head of long chain skips all of it
+{
+	echo "exec[id=c0]:/bin/sleep 30"
+	for i in $(seq 1 100000); do echo "exec[id=c$i after=c$((i-1))]:/bin/true"; done
+	echo "cancel:c0"
+} > chain.txt
+script=$(control chain.sh <<-EOF
+	#!/bin/bash
+	cat $PWD/chain.txt
+	EOF
+)
+timeout 60 "$GOPARD" --max-queue=1000000 "$(status)" "$script" || fail "chain: gopard failed"
+ran=$(jobs_column 28 | wc -l)
+[ "$ran" = 1 ] || fail "chain: $ran jobs run"
@@ -0,0 +1,12 @@
+# more jobs than descriptors allow, with options adding descriptors per run
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	for i in \$(seq 1 200); do echo "exec:/bin/sleep 0.2"; done
+	echo "exec[index=50 stdin=pipe id=p]:/bin/cat"
+	echo "eof:p"
+	EOF
+)
+( ulimit -n 256; timeout 60 "$GOPARD" --index=100 --sample=100 "$(status)" "$script" ) \
+	|| fail "gopard failed"
+ok=$(jobs_column 4 | grep -c '^0$')
+[ "$ok" = 201 ] || fail "$ok of 201 jobs finished with 0"
@@ -0,0 +1,22 @@
+# every stdindex.csv row of compressed log is a place to start reading
+cat > job.sh <<-EOF
+	#!/bin/bash
+	seq 1 1000; sleep 11; seq 1001 2000
+	EOF
+chmod +x job.sh
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	echo "exec[compress=1000000]:$PWD/job.sh"
+	EOF
+)
+timeout 60 "$GOPARD" "$(status)" "$script" || fail "gopard failed"
+./job.sh > plain
+dir=$(echo status/DONE/*)
+rows=$(awk -F, '$1 == "out" { print $3 "," $4 }' "$dir/stdindex.csv")
+[ "$(echo "$rows" | wc -l)" -ge 3 ] || fail "no checkpoint rows: $rows"
+for row in $rows; do
+	size=${row%,*}
+	zoffset=${row#*,}
+	tail -c +$((zoffset+1)) "$dir/stdout.log.gz" | zcat 2>/dev/null > part
+	tail -c +$((size+1)) plain | cmp -s - part || fail "row size=$size zoffset=$zoffset does not match output"
+done
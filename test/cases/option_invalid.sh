@@ -0,0 +1,10 @@
+# bad value of known exec option is not reported as unknown option
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	echo "exec[ionice=bogus]:/bin/true"
+	echo "exec[colour=red]:/bin/true"
+	EOF
+)
+timeout 30 "$GOPARD" "$(status)" "$script" 2> gopard.err || fail "gopard failed"
+grep -q "^Invalid value of exec option ionice=bogus$" gopard.err || fail "ionice=bogus: $(cat gopard.err)"
+grep -q "^Unknown exec option=colour$" gopard.err || fail "colour=red: $(cat gopard.err)"
@@ -0,0 +1,24 @@
+# relative PATH entries are looked up in cwd= of job, gopard's PWD is dropped
+mkdir -p tools/bin
+cat > tools/bin/hello <<-EOF
+	#!/bin/sh
+	echo hello
+	EOF
+chmod +x tools/bin/hello
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	echo "exec[id=rel cwd=$PWD/tools env=PATH=bin:/bin:/usr/bin]:hello"
+	echo "exec[id=dot cwd=$PWD/tools/bin env=PATH=/bin::/usr/bin]:hello"
+	echo "exec[id=none env=PATH=tools/bin:/bin:/usr/bin]:hello"
+	echo "exec[id=env]:/usr/bin/env"
+	EOF
+)
+timeout 30 "$GOPARD" "$(status)" "$script" 2> gopard.err || fail "gopard failed"
+output(){
+	cat "status/DONE/$(finished | awk -F, -v id="$1" '$28 == id { print $8 }' | xargs basename)/stdout.log"
+}
+[ "$(output rel)" = hello ] || fail "bin in PATH not found in cwd="
+[ "$(output dot)" = hello ] || fail "empty PATH entry not found in cwd="
+code=$(finished | awk -F, '$28 == "none" { print $4 }')
+[ "$code" = 32512 ] || fail "job without cwd= found hello, status $code"
+output env | grep -q '^PWD=' && fail "gopard's PWD passed to job"
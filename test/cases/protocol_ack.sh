@@ -0,0 +1,10 @@
+# protocol:binary is acknowledged by first event frame
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	echo "protocol:binary"
+	head -c 33 > "$PWD/ack"
+	EOF
+)
+timeout 30 "$GOPARD" "$(status)" "$script" || fail "gopard failed"
+printf '\0\0\0\035e\0\0\0\002\0\0\0\011protocol\0\0\0\0\007binary\0' > expect
+cmp -s expect ack || fail "ack frame: $(od -An -c ack)"
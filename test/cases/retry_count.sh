@@ -0,0 +1,13 @@
+# failed jobs run retry= more times, unless exit code is not in retryon=
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	echo "exec[id=f retry=2 backoff=50]:/bin/false"
+	echo "exec[id=g retry=3 retryon=4 backoff=50]:/bin/false"
+	echo "exec[id=t retry=5 backoff=50]:/bin/true"
+	EOF
+)
+timeout 30 "$GOPARD" "$(status)" "$script" || fail "gopard failed"
+attempts=$(jobs_column 28 | sort | uniq -c | awk '{ print $2 "=" $1 }' | tr '\n' ' ')
+[ "$attempts" = "f=3 g=1 t=1 " ] || fail "attempts: $attempts"
+last=$(finished | awk -F, '$28 == "f" { print $29 }' | sort -n | tail -1)
+[ "$last" = 3 ] || fail "last attempt of f is $last"
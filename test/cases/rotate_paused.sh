@@ -0,0 +1,17 @@
+# outlet pauses under 4k chunks, rotation must not leave pipe disarmed
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	for i in 1 2 3; do echo "exec[rotate=100000]:/usr/bin/seq 1 3000000"; done
+	EOF
+)
+expect=$(seq 1 3000000 | wc -c)
+for workers in 0 2; do
+	if ! timeout 60 "$GOPARD" --write-buffer=4096 --workers=$workers "$(status)" "$script"; then
+		fail "workers=$workers did not finish"
+		continue
+	fi
+	for dir in status/DONE/*; do
+		size=$(cat "$dir"/stdout.log* | wc -c)
+		[ "$size" = "$expect" ] || fail "workers=$workers $dir has $size bytes, expected $expect"
+	done
+done
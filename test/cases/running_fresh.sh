@@ -0,0 +1,23 @@
+# running.csv follows runs as they start and finish
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	echo "exec[id=short]:/bin/sleep 0.5"
+	echo "exec[id=long]:/bin/sleep 30"
+	sleep 2
+	echo "cancel:long"
+	EOF
+)
+"$GOPARD" "$(status)" "$script" &
+pid=$!
+running(){
+	cat status/CONTROL/*/running.csv 2>/dev/null
+}
+sleep 0.3
+running | grep -q ',CONTROL,' || fail "control missing from running.csv"
+running | grep -q '/bin/sleep 0.5 ' || fail "short job missing from running.csv"
+running | grep -q '/bin/sleep 30 ' || fail "long job missing from running.csv"
+sleep 1
+running | grep -q '/bin/sleep 0.5 ' && fail "finished job still in running.csv"
+running | grep -q '/bin/sleep 30 ' || fail "long job missing from running.csv"
+wait $pid
+[ "$(running | wc -l)" = 1 ] || fail "runs left in running.csv at exit"
@@ -0,0 +1,9 @@
+# control exits with more jobs than max-queue plus pipe capacity unread
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	for i in \$(seq 1 10000); do echo "exec:/bin/true"; done
+	EOF
+)
+timeout 120 "$GOPARD" --max-running=32 --max-queue=500 "$(status)" "$script" || fail "gopard failed"
+ran=$(jobs_column 4 | grep -c '^0$')
+[ "$ran" = 10000 ] || fail "$ran of 10000 jobs finished"
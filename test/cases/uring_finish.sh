@@ -0,0 +1,20 @@
+# with --io=uring log is complete when job is reported finished
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	for i in \$(seq 1 20); do echo "exec:/usr/bin/seq 1 300000"; done
+	n=0
+	while [ \$n -lt 20 ] && read -t 20 line; do
+		case "\$line" in finished:*)
+			n=\$((n+1))
+			stat -c %s "\${line##*,}/stdout.log" >&2
+		esac
+	done
+	EOF
+)
+expect=$(seq 1 300000 | wc -c)
+timeout 60 "$GOPARD" --io=uring "$(status)" "$script" || fail "gopard failed"
+sizes=$(events | grep -c "^$expect$")
+[ "$sizes" = 20 ] || fail "$sizes of 20 logs complete at finished event"
+for dir in status/DONE/*; do
+	seq 1 300000 | cmp -s - "$dir/stdout.log" || fail "$dir/stdout.log differs from output"
+done
@@ -0,0 +1,12 @@
+# workers never touch pipes of runs they handed back
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	for i in \$(seq 1 3000); do echo "exec:/usr/bin/seq 1 2000"; done
+	EOF
+)
+expect=$(seq 1 2000 | wc -c)
+timeout 120 "$GOPARD" --workers=4 --max-running=64 "$(status)" "$script" 2> gopard.err \
+	|| fail "gopard failed"
+grep -m3 "failed" gopard.err | while read -r line; do fail "$line"; done
+sizes=$(jobs_column 9 | grep -c "^$expect$")
+[ "$sizes" = 3000 ] || fail "$sizes of 3000 jobs logged $expect bytes"
@@ -0,0 +1,16 @@
+# chunks overflowing writer queue wait in backlog, pipe is paused meanwhile
+script=$(control c.sh <<-EOF
+	#!/bin/bash
+	for i in 1 2 3 4; do echo "exec:/usr/bin/seq 1 300000"; done
+	EOF
+)
+seq 1 300000 > expect
+for workers in 0 2; do
+	if ! timeout 60 "$GOPARD" --write-buffer=16 --workers=$workers "$(status)" "$script"; then
+		fail "workers=$workers did not finish"
+		continue
+	fi
+	for dir in status/DONE/*; do
+		cmp -s expect "$dir/stdout.log" || fail "workers=$workers $dir/stdout.log differs from output"
+	done
+done
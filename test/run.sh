@@ -0,0 +1,57 @@
+#!/bin/bash
+#
+# Regression tests: run.sh <gopard binary> [case ...]
+# Every test/cases/<case>.sh runs gopard with control script written to its
+# own directory and checks status files, calling fail on mismatch. Prints
+# failures, exits 1 if any.
+#
+GOPARD=$(realpath "${1:-build/gopard}")
+shift
+TESTS=$(dirname "$(realpath "$0")")
+WORK=$(mktemp -d)
+trap 'rm -rf "${WORK:?}"' EXIT
+FAILED=0
+
+fail(){
+	echo "FAIL $CASE: $*"
+}
+
+# control <name>: stdin becomes control script of test
+control(){
+	cat > "$WORK/$CASE/$1"
+	chmod +x "$WORK/$CASE/$1"
+	echo "$WORK/$CASE/$1"
+}
+
+# status directory of case, emptied
+status(){
+	rm -rf "${WORK:?}/${CASE:?}/status"
+	echo "$WORK/$CASE/status"
+}
+
+finished(){
+	cat "$WORK/$CASE"/status/CONTROL/*/finished.csv
+}
+
+# column <n> of finished.csv rows of jobs
+jobs_column(){
+	finished | awk -F, -v c="$1" '$3 == "RUNNING" { print $c }'
+}
+
+# events control read, it has to copy them to stderr
+events(){
+	cat "$WORK/$CASE"/status/CONTROL/*/stderr.log
+}
+
+CASES=${*:-$(ls "$TESTS/cases" | sed 's/\.sh$//')}
+for CASE in $CASES; do
+	mkdir -p "$WORK/$CASE"
+	( cd "$WORK/$CASE" && . "$TESTS/cases/$CASE.sh" ) > "$WORK/$CASE/out.log" 2>&1
+	if grep -q "^FAIL" "$WORK/$CASE/out.log"; then
+		cat "$WORK/$CASE/out.log"
+		FAILED=1
+	else
+		echo "ok   $CASE"
+	fi
+done
+exit $FAILED